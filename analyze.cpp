@@ -0,0 +1,175 @@
+#include "analyze.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <map>
+
+using namespace PoDoFo;
+using namespace std;
+
+namespace {
+
+// Per document counts in power of two buckets: 0, 1, 2-3, 4-7, ...
+class Histogram {
+public:
+    void add(size_t value) {
+        size_t bucket = 0;
+        while (value >> bucket) {
+            bucket++;
+        }
+        if (bucket >= m_buckets.size()) {
+            m_buckets.resize(bucket + 1, 0);
+        }
+        m_buckets[bucket]++;
+    }
+
+    void print(const char* title, size_t documents) const {
+        cout << title << " per document" << endl;
+        for (size_t bucket = 0; bucket < m_buckets.size(); bucket++) {
+            if (m_buckets[bucket] == 0) {
+                continue;
+            }
+            char range[48];
+            if (bucket <= 1) {
+                snprintf(range, sizeof(range), "%zu", bucket);
+            } else {
+                snprintf(range, sizeof(range), "%zu-%zu", size_t(1) << (bucket - 1), (size_t(1) << bucket) - 1);
+            }
+            char line[96];
+            snprintf(line, sizeof(line), "  %15s %9zu %6.1f%%", range, m_buckets[bucket],
+                     100.0 * m_buckets[bucket] / documents);
+            cout << line << endl;
+        }
+    }
+
+private:
+    vector<size_t> m_buckets;
+};
+
+bool isPdf(const filesystem::path& path) {
+    string extension = path.extension().string();
+    transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return tolower(c); });
+    return extension == ".pdf";
+}
+
+// The files named, and the PDFs found under the directories named, sorted
+vector<string> corpusFiles(const vector<string>& paths) {
+    vector<string> files;
+    for (const string& path : paths) {
+        std::error_code error;
+        if (!filesystem::is_directory(path, error)) {
+            files.push_back(path);
+            continue;
+        }
+        for (filesystem::recursive_directory_iterator entry(path, error), end; !error && entry != end;
+             entry.increment(error)) {
+            if (entry->is_regular_file(error) && isPdf(entry->path())) {
+                files.push_back(entry->path().string());
+            }
+        }
+        if (error) {
+            std::cerr << path << ": " << error.message() << std::endl;
+        }
+    }
+    sort(files.begin(), files.end());
+    return files;
+}
+
+enum class Outcome { Analyzed, Failed, OverBudget };
+
+} // namespace
+
+int runAnalyze(const vector<string>& paths, const NormalizeOptions& options) {
+    vector<string> files = corpusFiles(paths);
+    auto start = chrono::steady_clock::now();
+
+    // Documents are the unit of parallelism, each one is analyzed on a single thread. stdout is
+    // for the report alone, so the per document progress messages stay off and a document that
+    // fails is reported on stderr with its name.
+    NormalizeOptions documentOptions = options;
+    documentOptions.threads = 1;
+    documentOptions.verbose = false;
+    vector<DocumentAnalysis> results(files.size());
+    vector<Outcome> outcomes(files.size(), Outcome::Analyzed);
+    parallelFor(files.size(), workerCount(options.threads), [&](size_t i) {
+        try {
+            results[i] = analyzeFile(files[i], documentOptions);
+        } catch (const BudgetExceeded& e) {
+            outcomes[i] = Outcome::OverBudget;
+            std::cerr << files[i] << ": " << e.what() << std::endl;
+        } catch (const PdfError& e) {
+            outcomes[i] = Outcome::Failed;
+            std::cerr << files[i] << ": Error: " << e.what() << std::endl;
+        } catch (const std::exception& e) {
+            outcomes[i] = Outcome::Failed;
+            std::cerr << files[i] << ": Exception: " << e.what() << std::endl;
+        }
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    DocumentAnalysis total;
+    map<string, size_t> actions;
+    size_t analyzed = 0;
+    size_t parsed = 0;
+    size_t failed = 0;
+    size_t overBudget = 0;
+    Histogram fields, widgets, appearanceStreams, fieldEdits, activeActions;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (outcomes[i] != Outcome::Analyzed) {
+            (outcomes[i] == Outcome::OverBudget ? overBudget : failed)++;
+            continue;
+        }
+        const DocumentAnalysis& result = results[i];
+        analyzed++;
+        parsed += result.parsed ? 1 : 0;
+        total.fields += result.fields;
+        total.textBoxes += result.textBoxes;
+        total.checkBoxes += result.checkBoxes;
+        total.radioGroups += result.radioGroups;
+        total.otherFields += result.otherFields;
+        total.widgets += result.widgets;
+        total.valuesCleared += result.valuesCleared;
+        total.statesReset += result.statesReset;
+        total.appearanceStreams += result.appearanceStreams;
+        total.fieldEdits += result.fieldEdits;
+        total.activeActions += result.activeActions;
+        total.actionTriggers += result.actionTriggers;
+        for (const auto& action : result.actions) {
+            actions[action.first] += action.second;
+        }
+        fields.add(result.fields);
+        widgets.add(result.widgets);
+        appearanceStreams.add(result.appearanceStreams);
+        fieldEdits.add(result.fieldEdits);
+        activeActions.add(result.activeActions);
+    }
+
+    cout << "Documents: " << analyzed << " analyzed (" << analyzed - parsed
+         << " without forms or active content, not parsed), " << failed << " failed, " << overBudget
+         << " over budget, in " << seconds << " s" << endl;
+    cout << "Fields: " << total.fields << " (" << total.textBoxes << " text, " << total.checkBoxes << " check box, "
+         << total.radioGroups << " radio, " << total.otherFields << " other), " << total.widgets << " widgets" << endl;
+    cout << "Field changes: " << total.fieldEdits << " edits, " << total.valuesCleared << " values cleared, "
+         << total.statesReset << " states reset, " << total.appearanceStreams << " appearance streams replaced" << endl;
+    cout << "Active content: " << total.activeActions << " actions";
+    const char* separator = " (";
+    for (const auto& action : actions) {
+        cout << separator << action.second << " " << action.first;
+        separator = ", ";
+    }
+    cout << (actions.empty() ? "" : ")") << ", " << total.actionTriggers << " triggers" << endl;
+
+    if (analyzed > 0) {
+        fields.print("Fields", analyzed);
+        widgets.print("Widgets", analyzed);
+        appearanceStreams.print("Appearance streams", analyzed);
+        fieldEdits.print("Field edits", analyzed);
+        activeActions.print("Active actions", analyzed);
+    }
+    return analyzed > 0 ? 0 : 2;
+}
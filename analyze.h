@@ -0,0 +1,16 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include "normalizer.h"
+
+#include <string>
+#include <vector>
+
+// Dry run over a corpus for capacity planning: every file named in paths, and every *.pdf under
+// the directories named there, goes through the normalizer's rules (analyzeFile()) without
+// anything being changed or saved, options.threads documents at a time. Prints the totals and
+// histograms of the per document counts on stdout, documents that fail on stderr. Returns the
+// exit status, 2 when no document could be analyzed.
+int runAnalyze(const std::vector<std::string>& paths, const NormalizeOptions& options);
+
+#endif // ANALYZE_H
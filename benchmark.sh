@@ -0,0 +1,55 @@
+#!/bin/sh
+# Times the normalizer built three ways, unoptimized (-O0), -O2, and PGO+LTO from pgoBuild.sh,
+# on the sample PDFs and the synthetic corpus:
+#   ./benchmark.sh [WORK_DIR] [RUNS]
+# Prints the best of RUNS (5) wall times per document in milliseconds. TARGET and ASSETS are as
+# for pgoBuild.sh. The PGO build is measured on the documents it trained on, so check it against
+# a sample of real documents too (CORPUS=DIR adds the PDFs in DIR). FLAGS adds normalization
+# options to every run.
+set -e
+
+source=$(cd "$(dirname "$0")" && pwd)
+work=${1:-$source/build-benchmark}
+runs=${2:-5}
+mkdir -p "$work"
+work=$(cd "$work" && pwd)
+target=${TARGET:-untitled}
+assets=${ASSETS:-$source}
+
+build() {
+    cmake -S "$source" -B "$work/$1" -DCMAKE_BUILD_TYPE=None -DCMAKE_CXX_FLAGS="$2" > /dev/null
+    cmake --build "$work/$1" -j "$(nproc)" > /dev/null
+}
+
+build O0 -O0
+build O2 "-O2 -DNDEBUG"
+"$source/pgoBuild.sh" "$work/pgo-lto" > /dev/null
+
+corpus=$work/corpus
+python3 "$source/syntheticForms.py" "$corpus"
+cp "$assets"/*.pdf "$corpus"/
+[ -n "$CORPUS" ] && cp "$CORPUS"/*.pdf "$corpus"/
+
+# Best wall time of the runs, in milliseconds
+best() {
+    fastest=
+    i=0
+    while [ $i -lt "$runs" ]; do
+        start=$(date +%s%N)
+        "$work/$1/$target" --templates="$assets" --output-dir="$work/output" $FLAGS "$2" out.pdf > /dev/null 2>&1 ||
+            echo "Failed: $1 $2" >&2
+        elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+        if [ -z "$fastest" ] || [ "$elapsed" -lt "$fastest" ]; then
+            fastest=$elapsed
+        fi
+        i=$((i + 1))
+    done
+    echo "$fastest"
+}
+
+mkdir -p "$work/output"
+printf '%-28s %10s %10s %10s\n' document -O0 -O2 PGO+LTO
+for pdf in "$corpus"/*.pdf; do
+    printf '%-28s %10s %10s %10s\n' "$(basename "$pdf")" "$(best O0 "$pdf")" "$(best O2 "$pdf")" \
+        "$(best pgo-lto "$pdf")"
+done
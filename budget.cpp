@@ -0,0 +1,231 @@
+#include "budget.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <thread>
+
+#include <pthread.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace std;
+
+namespace {
+
+thread_local DocumentBudget* currentBudget = nullptr;
+
+// Only the heavier limits (resident set) are looked at on every nth check
+const unsigned rssCheckInterval = 64;
+
+double wallSeconds() {
+    timespec now {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+double cpuSeconds(clockid_t clock) {
+    timespec now {};
+    clock_gettime(clock, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+double threadCpuSeconds() {
+    return cpuSeconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+clockid_t threadCpuClock() {
+    clockid_t clock = CLOCK_THREAD_CPUTIME_ID;
+    pthread_getcpuclockid(pthread_self(), &clock);
+    return clock;
+}
+
+// Inflated in pieces of this size, which are charged and dropped
+const size_t inflateChunkBytes = 64 << 10;
+
+// Pages from /proc/self/statm, field is 0 for the virtual size and 1 for the resident set
+uint64_t statmBytes(int field) {
+    ifstream statm("/proc/self/statm");
+    uint64_t pages = 0;
+    for (int i = 0; i <= field && statm >> pages; i++) {
+    }
+    return pages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+string formatLimit(double used, double limit, const char* unit) {
+    char detail[96];
+    snprintf(detail, sizeof(detail), "%.2f%s used, limit %.2f%s", used, unit, limit, unit);
+    return detail;
+}
+
+[[noreturn]] void exitOverBudget(const char* message) {
+    // Async signal safe, may run from a signal handler or while the main thread is stuck
+    ssize_t ignored = write(STDERR_FILENO, message, strlen(message));
+    (void)ignored;
+    _exit(exitBudgetExceeded);
+}
+
+void onCpuLimit(int) {
+    exitOverBudget("Budget exceeded: cpu time (hard limit)\n");
+}
+
+} // namespace
+
+BudgetExceeded::BudgetExceeded(const string& limit, const string& stage, const string& detail)
+    : runtime_error("Budget exceeded: " + limit + " during " + stage + " (" + detail + ")"), m_limit(limit) {
+}
+
+DocumentBudget::DocumentBudget(const BudgetLimits& limits)
+    : m_limits(limits), m_wallStart(wallSeconds()), m_cpuClock(threadCpuClock()), m_cpuStart(cpuSeconds(m_cpuClock)),
+      m_rssStart(limits.heapBytes > 0 ? statmBytes(1) : 0), m_previous(currentBudget) {
+    currentBudget = this;
+}
+
+DocumentBudget::~DocumentBudget() {
+    currentBudget = m_previous;
+}
+
+DocumentBudget* DocumentBudget::current() {
+    return currentBudget;
+}
+
+void DocumentBudget::check(const char* stage) {
+    if (m_limits.wallSeconds > 0) {
+        double used = wallSeconds() - m_wallStart;
+        if (used > m_limits.wallSeconds) {
+            throw BudgetExceeded("wall time", stage, formatLimit(used, m_limits.wallSeconds, "s"));
+        }
+    }
+    if (m_limits.cpuSeconds > 0) {
+        double used = cpuSeconds(m_cpuClock) - m_cpuStart + m_workerCpuNanoseconds / 1e9;
+        if (used > m_limits.cpuSeconds) {
+            throw BudgetExceeded("cpu time", stage, formatLimit(used, m_limits.cpuSeconds, "s"));
+        }
+    }
+    if (m_limits.heapBytes > 0 && m_checks++ % rssCheckInterval == 0) {
+        uint64_t rss = statmBytes(1);
+        uint64_t used = rss > m_rssStart ? rss - m_rssStart : 0;
+        if (used > m_limits.heapBytes) {
+            throw BudgetExceeded("heap", stage, formatLimit(used / 1048576.0, m_limits.heapBytes / 1048576.0, "MB"));
+        }
+    }
+}
+
+void DocumentBudget::chargeDecoded(uint64_t bytes, const char* stage) {
+    uint64_t decoded = m_decoded += bytes;
+    if (m_limits.decodedBytes > 0 && decoded > m_limits.decodedBytes) {
+        throw BudgetExceeded("decoded stream bytes", stage,
+                             to_string(decoded) + " bytes decoded, limit " + to_string(m_limits.decodedBytes));
+    }
+}
+
+void DocumentBudget::chargeCpu(double seconds) {
+    if (seconds > 0) {
+        m_workerCpuNanoseconds += static_cast<uint64_t>(seconds * 1e9);
+    }
+}
+
+BudgetShare::BudgetShare(DocumentBudget* budget)
+    : m_budget(budget), m_previous(currentBudget), m_cpuCharged(budget ? threadCpuSeconds() : 0) {
+    currentBudget = budget;
+}
+
+BudgetShare::~BudgetShare() {
+    charge();
+    currentBudget = m_previous;
+}
+
+void BudgetShare::charge() {
+    if (m_budget) {
+        double now = threadCpuSeconds();
+        m_budget->chargeCpu(now - m_cpuCharged);
+        m_cpuCharged = now;
+    }
+}
+
+void checkBudget(const char* stage) {
+    if (currentBudget) {
+        currentBudget->check(stage);
+    }
+}
+
+void chargeDecodedBytes(uint64_t bytes, const char* stage) {
+    if (currentBudget) {
+        currentBudget->chargeDecoded(bytes, stage);
+    }
+}
+
+void chargeInflatedBytes(const char* data, size_t size, const char* stage) {
+    if (!currentBudget) {
+        return;
+    }
+    z_stream inflater {};
+    if (inflateInit(&inflater) != Z_OK) {
+        currentBudget->chargeDecoded(size, stage);
+        return;
+    }
+    string chunk(inflateChunkBytes, '\0');
+    inflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    inflater.avail_in = static_cast<uInt>(min<size_t>(size, UINT32_MAX));
+    uint64_t inflated = 0;
+    int status = Z_OK;
+    try {
+        while (status == Z_OK) {
+            inflater.next_out = reinterpret_cast<Bytef*>(&chunk[0]);
+            inflater.avail_out = static_cast<uInt>(chunk.size());
+            status = inflate(&inflater, Z_NO_FLUSH);
+            size_t produced = chunk.size() - inflater.avail_out;
+            if (produced == 0) {
+                break;
+            }
+            inflated += produced;
+            currentBudget->chargeDecoded(produced, stage);
+        }
+    } catch (...) {
+        inflateEnd(&inflater);
+        throw;
+    }
+    inflateEnd(&inflater);
+    if (inflated == 0) {
+        currentBudget->chargeDecoded(size, stage);
+    }
+}
+
+bool decodedBytesLimited() {
+    return currentBudget && currentBudget->limits().decodedBytes > 0;
+}
+
+void enforceProcessLimits(const BudgetLimits& limits) {
+    if (limits.wallSeconds > 0) {
+        // A second of grace so the cooperative check reports the stage when it can
+        auto deadline = chrono::duration<double>(limits.wallSeconds + 1.0);
+        thread([deadline] {
+            this_thread::sleep_for(deadline);
+            exitOverBudget("Budget exceeded: wall time (hard limit)\n");
+        }).detach();
+    }
+
+    if (limits.cpuSeconds > 0) {
+        signal(SIGXCPU, onCpuLimit);
+        rlimit cpu {};
+        getrlimit(RLIMIT_CPU, &cpu);
+        cpu.rlim_cur = static_cast<rlim_t>(ceil(limits.cpuSeconds)) + 1;
+        setrlimit(RLIMIT_CPU, &cpu);
+    }
+
+    if (limits.heapBytes > 0) {
+        // Address space rather than heap, so leave room over what is already mapped;
+        // allocations past it fail with bad_alloc, which the caller reports as the heap limit
+        rlimit memory {};
+        getrlimit(RLIMIT_AS, &memory);
+        rlim_t wanted = static_cast<rlim_t>(statmBytes(0) + 2 * limits.heapBytes);
+        memory.rlim_cur = memory.rlim_max == RLIM_INFINITY ? wanted : min(wanted, memory.rlim_max);
+        setrlimit(RLIMIT_AS, &memory);
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+
+// Exit status of the normalizer when a document runs out of budget
+const int exitBudgetExceeded = 3;
+
+// Per-document resource limits, 0 leaves a limit off
+struct BudgetLimits {
+    double wallSeconds = 0;
+    double cpuSeconds = 0;
+    uint64_t decodedBytes = 0;
+    // Growth of the resident set since the document started. The resident set belongs to the
+    // process, so while other documents run alongside (server, hot folder, --analyze) their
+    // growth counts too: an approximate backstop, not a per-document measure.
+    uint64_t heapBytes = 0;
+
+    bool any() const { return wallSeconds > 0 || cpuSeconds > 0 || decodedBytes > 0 || heapBytes > 0; }
+};
+
+class BudgetExceeded : public std::runtime_error {
+public:
+    BudgetExceeded(const std::string& limit, const std::string& stage, const std::string& detail);
+    const std::string& limit() const { return m_limit; }
+
+private:
+    std::string m_limit;
+};
+
+// Tracks one document on the current thread. While it is alive, checkBudget() and
+// chargeDecodedBytes() on that thread (and on the workers it lends itself to, see BudgetShare)
+// count against it and throw BudgetExceeded once a limit is passed, so the normalizer unwinds
+// out of whatever it was doing. CPU time is that of the creating thread plus what the workers
+// charged.
+class DocumentBudget {
+public:
+    explicit DocumentBudget(const BudgetLimits& limits);
+    ~DocumentBudget();
+    DocumentBudget(const DocumentBudget&) = delete;
+    DocumentBudget& operator=(const DocumentBudget&) = delete;
+
+    void check(const char* stage);
+    void chargeDecoded(uint64_t bytes, const char* stage);
+    void chargeCpu(double seconds);
+    const BudgetLimits& limits() const { return m_limits; }
+
+    static DocumentBudget* current();
+
+private:
+    BudgetLimits m_limits;
+    double m_wallStart;
+    clockid_t m_cpuClock;       // CPU clock of the creating thread, readable from the workers
+    double m_cpuStart;
+    uint64_t m_rssStart;
+    std::atomic<uint64_t> m_workerCpuNanoseconds { 0 };
+    std::atomic<uint64_t> m_decoded { 0 };
+    std::atomic<unsigned> m_checks { 0 };
+    DocumentBudget* m_previous;
+};
+
+// Lends the budget of the thread that started some parallel work (DocumentBudget::current()
+// there, null for none) to a worker thread: while the share is alive, checks and decoded bytes
+// on the worker count against that budget, and so does the worker's CPU time, charged by
+// charge() and when the share ends. parallelFor() gives each of its workers one.
+class BudgetShare {
+public:
+    explicit BudgetShare(DocumentBudget* budget);
+    ~BudgetShare();
+    BudgetShare(const BudgetShare&) = delete;
+    BudgetShare& operator=(const BudgetShare&) = delete;
+
+    void charge();
+
+private:
+    DocumentBudget* m_budget;
+    DocumentBudget* m_previous;
+    double m_cpuCharged;
+};
+
+// Cooperative check points, free when no budget is active on this thread
+void checkBudget(const char* stage);
+void chargeDecodedBytes(uint64_t bytes, const char* stage);
+
+// Charge what FlateDecode data inflates to, inflating it a piece at a time so a decompression
+// bomb stops at the limit rather than after it. Data that doesn't inflate counts at its size.
+void chargeInflatedBytes(const char* data, size_t size, const char* stage);
+
+// Whether the budget on this thread limits decoded bytes, to skip work done only to charge them
+bool decodedBytesLimited();
+
+// Hard backstops for the single document command line run, for the stretches the
+// cooperative checks can't see into (PoDoFo parsing the file): a watchdog that ends the
+// process past the wall limit, RLIMIT_CPU for CPU time and RLIMIT_AS for memory.
+// Each reports the limit on stderr and exits with exitBudgetExceeded.
+void enforceProcessLimits(const BudgetLimits& limits);
+
+#endif // BUDGET_H
@@ -0,0 +1,321 @@
+#include "hotFolder.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// Room for a burst of events; each is a header plus a NUL padded name
+const size_t eventBufferBytes = 64 << 10;
+
+bool isInput(const string& name) {
+    if (name.empty() || name[0] == '.' || name.size() < 4) {
+        return false;
+    }
+    string extension = name.substr(name.size() - 4);
+    transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return tolower(c); });
+    return extension == ".pdf";
+}
+
+class HotFolder {
+public:
+    explicit HotFolder(const WatchOptions& options) : m_options(options) {}
+    int run();
+
+private:
+    // Queue a batch of file names, skipping the ones already queued or being normalized
+    void enqueue(vector<string>& batch);
+    void work();
+    void process(const string& name);
+    // Every input waiting in the folder, for start up and after the event queue overflowed
+    void scan(vector<string>& batch);
+    // Inputs a stopped run left in processing/ go back into the folder to be taken again
+    void recover();
+
+    const WatchOptions& m_options;
+    NormalizeOptions m_normalize;   // m_options.normalize with the threads shared out between workers
+    string m_processing;
+    string m_done;
+    string m_failed;
+    atomic<unsigned> m_nextTemporary { 0 };
+
+    mutex m_filesMutex;
+    condition_variable m_filesReady;
+    deque<string> m_files;
+    unordered_set<string> m_pending;  // Queued or being normalized
+    unordered_set<string> m_again;    // Arrived again while being normalized
+    bool m_stopping = false;
+};
+
+void HotFolder::enqueue(vector<string>& batch) {
+    size_t added = 0;
+    {
+        lock_guard<mutex> lock(m_filesMutex);
+        for (string& name : batch) {
+            if (m_pending.insert(name).second) {
+                m_files.push_back(std::move(name));
+                added++;
+            } else {
+                m_again.insert(name);
+            }
+        }
+    }
+    batch.clear();
+    if (added > 0) {
+        m_filesReady.notify_all();
+    }
+}
+
+void HotFolder::work() {
+    for (;;) {
+        string name;
+        {
+            unique_lock<mutex> lock(m_filesMutex);
+            m_filesReady.wait(lock, [this] { return !m_files.empty() || m_stopping; });
+            if (m_files.empty()) {
+                return;
+            }
+            name = std::move(m_files.front());
+            m_files.pop_front();
+        }
+        process(name);
+
+        // A new file under the same name may have landed while this one was being normalized
+        lock_guard<mutex> lock(m_filesMutex);
+        std::error_code error;
+        if (m_again.erase(name) > 0 && filesystem::exists(m_options.directory + "/" + name, error)) {
+            m_files.push_back(name);
+        } else {
+            m_pending.erase(name);
+        }
+    }
+}
+
+void HotFolder::process(const string& name) {
+    string arrived = m_options.directory + "/" + name;
+    string input = m_processing + "/" + name;
+    string output = m_options.outputDirectory + "/" + name;
+    string temporary = m_options.outputDirectory + "/." + name + "." + to_string(m_nextTemporary++);
+    auto start = chrono::steady_clock::now();
+
+    // Out of the folder before it is read: a new file landing under the same name then waits
+    // for its own turn instead of replacing this one halfway through. Only one document per
+    // name is in work at a time, so the name is free in processing/.
+    std::error_code error;
+    filesystem::rename(arrived, input, error);
+    if (error) {
+        std::cerr << "Cannot take " << arrived << " from the hot folder: " << error.message() << std::endl;
+        return;
+    }
+
+    string message;
+    int status = 2;
+    try {
+        status = normalizeFileStatus(input, temporary, m_normalize, message);
+        if (status == 0) {
+            filesystem::rename(temporary, output);
+        }
+    } catch (const std::exception& e) {
+        status = 2;
+        message = string("Exception: ") + e.what();
+        std::cerr << message << std::endl;
+    }
+    filesystem::remove(temporary, error);
+
+    // Archived either way, so a restart doesn't normalize it again
+    filesystem::rename(input, (status == 0 ? m_done : m_failed) + "/" + name, error);
+    if (error) {
+        std::cerr << "Cannot move " << input << " out of processing: " << error.message() << std::endl;
+    }
+    if (status == 0) {
+        cout << "Normalized " << name << " in "
+             << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+    } else {
+        std::cerr << "Failed " << name << ": " << message << std::endl;
+    }
+}
+
+void HotFolder::scan(vector<string>& batch) {
+    std::error_code error;
+    for (filesystem::directory_iterator entry(m_options.directory, error), end; !error && entry != end;
+         entry.increment(error)) {
+        string name = entry->path().filename().string();
+        if (entry->is_regular_file(error) && isInput(name)) {
+            batch.push_back(name);
+        }
+    }
+    sort(batch.begin(), batch.end());
+}
+
+void HotFolder::recover() {
+    std::error_code error;
+    for (filesystem::directory_iterator entry(m_processing, error), end; !error && entry != end;
+         entry.increment(error)) {
+        string name = entry->path().filename().string();
+        string arrived = m_options.directory + "/" + name;
+        std::error_code moved;
+        // A newer file under the same name wins, the old one is left where it is
+        if (filesystem::exists(arrived, moved)) {
+            cerr << "Left " << entry->path().string() << " in processing, " << arrived << " arrived since" << endl;
+            continue;
+        }
+        filesystem::rename(entry->path(), arrived, moved);
+        if (moved) {
+            cerr << "Cannot move " << entry->path().string() << " back: " << moved.message() << endl;
+        }
+    }
+}
+
+int HotFolder::run() {
+    m_processing = m_options.directory + "/processing";
+    m_done = m_options.directory + "/done";
+    m_failed = m_options.directory + "/failed";
+    try {
+        for (const string& directory : { m_options.outputDirectory, m_processing, m_done, m_failed }) {
+            filesystem::create_directories(directory);
+        }
+    } catch (const std::exception& e) {
+        cerr << "Cannot set up the hot folder: " << e.what() << endl;
+        return 2;
+    }
+    recover();
+
+    // Outputs are renamed into place, which in the watched directory would arrive as new inputs
+    // and be normalized again. Outputs under it would mix with the inputs and their done/ and
+    // failed/ directories, so both are refused.
+    try {
+        filesystem::path watched = filesystem::canonical(m_options.directory);
+        filesystem::path output = filesystem::canonical(m_options.outputDirectory);
+        if (mismatch(watched.begin(), watched.end(), output.begin(), output.end()).first == watched.end()) {
+            cerr << "The output directory " << m_options.outputDirectory << " can't be in the watched directory "
+                 << m_options.directory << endl;
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        cerr << "Cannot set up the hot folder: " << e.what() << endl;
+        return 2;
+    }
+
+    // Watched before the first scan, so nothing that lands in between is missed
+    int events = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (events < 0 || inotify_add_watch(events, m_options.directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        cerr << "Cannot watch " << m_options.directory << ": " << strerror(errno) << endl;
+        return 2;
+    }
+
+    // Blocked before the workers start so they inherit the mask, and only the loop sees the signals
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stopSignals, nullptr);
+    int signals = signalfd(-1, &stopSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signals < 0) {
+        cerr << "Cannot watch for stop signals: " << strerror(errno) << endl;
+        sigprocmask(SIG_UNBLOCK, &stopSignals, nullptr);
+        close(events);
+        return 2;
+    }
+
+    // Every worker normalizes a document of its own, so threads=0 means a share of the hardware
+    // threads each rather than all of them
+    unsigned workers = workerCount(m_options.workers);
+    m_normalize = m_options.normalize;
+    if (m_normalize.threads == 0) {
+        m_normalize.threads = documentThreads(workers);
+    }
+    vector<thread> pool;
+    for (unsigned i = 0; i < workers; i++) {
+        pool.emplace_back([this] { work(); });
+    }
+    cout << "Watching " << m_options.directory << " with " << workers << " workers" << endl;
+
+    vector<string> batch;
+    scan(batch);
+    enqueue(batch);
+
+    vector<char> buffer(eventBufferBytes);
+    auto deadline = chrono::steady_clock::now();
+    pollfd descriptors[] = { { events, POLLIN, 0 }, { signals, POLLIN, 0 } };
+    for (;;) {
+        // Waits for the next arrival, or for the rest of the batch window once one came in
+        int timeout = -1;
+        if (!batch.empty()) {
+            auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+            timeout = static_cast<int>(max<chrono::milliseconds::rep>(0, left.count()));
+        }
+        if (poll(descriptors, 2, timeout) < 0 && errno != EINTR) {
+            cerr << "poll: " << strerror(errno) << endl;
+            break;
+        }
+        if (descriptors[1].revents & POLLIN) {
+            break;
+        }
+
+        if (descriptors[0].revents & POLLIN) {
+            ssize_t size;
+            while ((size = read(events, buffer.data(), buffer.size())) > 0) {
+                for (char* next = buffer.data(); next < buffer.data() + size;) {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(next);
+                    next += sizeof(inotify_event) + event->len;
+                    if (batch.empty()) {
+                        deadline = chrono::steady_clock::now() + chrono::milliseconds(m_options.batchMilliseconds);
+                    }
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        // Events were dropped, the folder itself says what arrived
+                        scan(batch);
+                    } else if (event->len > 0 && isInput(event->name)) {
+                        batch.push_back(event->name);
+                    }
+                }
+            }
+        }
+
+        if (!batch.empty() && (batch.size() >= m_options.maxBatch || chrono::steady_clock::now() >= deadline)) {
+            enqueue(batch);
+        }
+    }
+
+    // Whatever is already queued is still normalized
+    cout << "Stopping, finishing the queued documents" << endl;
+    enqueue(batch);
+    {
+        lock_guard<mutex> lock(m_filesMutex);
+        m_stopping = true;
+    }
+    m_filesReady.notify_all();
+    for (thread& worker : pool) {
+        worker.join();
+    }
+    close(signals);
+    close(events);
+    return 0;
+}
+
+} // namespace
+
+int runWatch(const WatchOptions& options) {
+    HotFolder hotFolder(options);
+    return hotFolder.run();
+}
@@ -0,0 +1,30 @@
+#ifndef HOT_FOLDER_H
+#define HOT_FOLDER_H
+
+#include "normalizer.h"
+
+#include <cstddef>
+#include <string>
+
+struct WatchOptions {
+    std::string directory;          // Hot folder the scanners drop PDFs into, empty when not watching
+    std::string outputDirectory = "normalized";
+    unsigned workers = 0;           // Documents normalized at once, 0 for one per hardware thread
+    unsigned batchMilliseconds = 20; // How long to keep collecting arrivals after the first one of a batch
+    size_t maxBatch = 256;          // A batch goes out at this size without waiting
+    NormalizeOptions normalize;     // threads 0 shares the hardware threads out between the workers
+};
+
+// Normalize PDFs as they land in options.directory: inotify reports every file closed after
+// writing or moved in, arrivals are collected into short batches and handed to a pool of workers,
+// each document under its own budget. A worker first moves its input to processing/ inside the
+// hot folder, so a new file under the same name can't replace it while it is read. The output is
+// written to a hidden temporary file in the output directory and renamed to the input's name, so
+// readers only ever see whole documents. Inputs then move on to done/ or failed/, which also
+// keeps them from being picked up again; those already in the folder at start up are taken
+// first, along with any a stopped run left in processing/. Hidden files and names not
+// ending in .pdf are ignored. Runs until SIGINT or SIGTERM, finishing the documents already
+// queued; returns 2 when the folder can't be watched.
+int runWatch(const WatchOptions& options);
+
+#endif // HOT_FOLDER_H
@@ -0,0 +1,808 @@
+#include "httpServer.h"
+#include "parallel.h"
+#include "preflight.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const size_t maxHeaderBytes = 16 << 10;
+const size_t maxJsonBytes = 64 << 10;
+const size_t readChunk = 64 << 10;
+
+// Connections that make no progress for this long, reading or writing, are dropped
+const time_t idleSeconds = 60;
+
+// epoll ids of the two non connection descriptors, connections count up from firstConnectionId
+const uint64_t listenId = 0;
+const uint64_t wakeId = 1;
+const uint64_t firstConnectionId = 2;
+
+enum class Route { Download, Normalize };
+
+struct Job {
+    uint64_t connection;
+    Route route;
+    string workspace;
+    string input;       // The file to normalize, downloaded or uploaded
+    string url;
+};
+
+struct Result {
+    uint64_t connection;
+    string workspace;
+    int status;
+    string contentType;
+    string body;        // Sent when file is empty
+    string file;        // Sent with sendfile otherwise
+    string tag;         // ETag of file
+};
+
+struct Connection {
+    enum State { ReadingHeaders, ReadingBody, Working, Writing };
+
+    int fd = -1;
+    State state = ReadingHeaders;
+    bool gone = false;          // The client hung up while its document was being normalized
+    time_t lastActivity = 0;
+    string buffer;              // The request headers, then the JSON body of /download_pdf
+    string target;
+    Route route = Route::Normalize;
+    uint64_t contentLength = 0;
+    uint64_t received = 0;
+    string workspace;
+    string input;
+    int inputFd = -1;
+    string response;            // Status line, headers and any in memory body
+    size_t responseSent = 0;
+    int fileFd = -1;
+    off_t fileOffset = 0;
+    off_t fileSize = 0;
+};
+
+const char* statusText(int status) {
+    switch (status) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 422: return "Unprocessable Entity";
+    case 431: return "Request Header Fields Too Large";
+    case 503: return "Service Unavailable";
+    default: return "Internal Server Error";
+    }
+}
+
+string jsonMessage(const char* key, const string& text) {
+    string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[7];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return string("{\"") + key + "\": \"" + escaped + "\"}\n";
+}
+
+// The "url" member of the JSON request body, false when there is none
+bool jsonUrl(const string& json, string& url) {
+    size_t pos = json.find("\"url\"");
+    if (pos == string::npos) {
+        return false;
+    }
+    pos = json.find_first_not_of(" \t\r\n", pos + 5);
+    if (pos == string::npos || json[pos] != ':') {
+        return false;
+    }
+    pos = json.find_first_not_of(" \t\r\n", pos + 1);
+    if (pos == string::npos || json[pos] != '"') {
+        return false;
+    }
+    url.clear();
+    for (pos++; pos < json.size(); pos++) {
+        char c = json[pos];
+        if (c == '"') {
+            return !url.empty();
+        }
+        if (c == '\\') {
+            // URLs only need the simple escapes
+            if (++pos >= json.size() || !strchr("\"\\/", json[pos])) {
+                return false;
+            }
+            c = json[pos];
+        }
+        url += c;
+    }
+    return false;
+}
+
+string percentDecode(const string& text) {
+    string decoded;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '%' && i + 2 < text.size() && isxdigit(static_cast<unsigned char>(text[i + 1]))
+            && isxdigit(static_cast<unsigned char>(text[i + 2]))) {
+            decoded += static_cast<char>(stoi(text.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            decoded += text[i] == '+' ? ' ' : text[i];
+        }
+    }
+    return decoded;
+}
+
+// Upload file name from ?name=, without any directory so it stays inside the workspace. The
+// name becomes the document title, like the input file name does on the command line.
+string uploadName(const string& target) {
+    size_t query = target.find('?');
+    string name;
+    while (query != string::npos) {
+        size_t next = target.find('&', query + 1);
+        string parameter = target.substr(query + 1, next == string::npos ? string::npos : next - query - 1);
+        if (parameter.rfind("name=", 0) == 0) {
+            name = documentTitle(percentDecode(parameter.substr(5)));
+        }
+        query = next;
+    }
+    return name.empty() || name == "." || name == ".." ? "upload.pdf" : name;
+}
+
+struct Download {
+    FILE* file;
+    uint64_t written;
+    uint64_t limit;
+    bool tooLarge;
+};
+
+size_t writeDownload(char* data, size_t size, size_t count, void* user) {
+    Download& download = *static_cast<Download*>(user);
+    size_t bytes = size * count;
+    if (download.written + bytes > download.limit) {
+        download.tooLarge = true;
+        return 0;
+    }
+    download.written += bytes;
+    return fwrite(data, 1, bytes, download.file);
+}
+
+bool downloadUrl(const string& url, const string& path, uint64_t limit, string& error) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        error = "Cannot create " + path;
+        return false;
+    }
+    Download download { file, 0, limit, false };
+    CURL* curl = curl_easy_init();
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
+    curl_easy_setopt(curl, CURLOPT_REDIR_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, idleSeconds);
+    curl_easy_setopt(curl, CURLOPT_MAXFILESIZE_LARGE, static_cast<curl_off_t>(limit));
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeDownload);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &download);
+    CURLcode status = curl_easy_perform(curl);
+    curl_easy_cleanup(curl);
+    bool written = fclose(file) == 0;
+
+    if (download.tooLarge || status == CURLE_FILESIZE_EXCEEDED) {
+        error = "Download larger than " + to_string(limit) + " bytes";
+        return false;
+    }
+    if (status != CURLE_OK) {
+        error = curl_easy_strerror(status);
+        return false;
+    }
+    if (!written) {
+        error = "Cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+// Leave a copy of the /download_pdf result in <directory>/normed.pdf, while the response is sent
+// from the workspace copy. The file is renamed into place so a concurrent request never sees half
+// of it; the last one to finish wins, as it did with webApp.py.
+void publishOutput(const string& file, const string& workspace, const string& directory) {
+    filesystem::create_directories(directory);
+    string staging = directory + "/." + filesystem::path(workspace).filename().string() + ".pdf";
+    std::error_code error;
+    filesystem::remove(staging, error);
+    filesystem::create_hard_link(file, staging, error);
+    if (error) {
+        // Different file system
+        filesystem::copy_file(file, staging, filesystem::copy_options::overwrite_existing);
+    }
+    filesystem::rename(staging, directory + "/normed.pdf");
+}
+
+// ETag of a finished output, hashed on the worker so the event loop never reads a document
+string fileTag(const string& file) {
+    MappedFile output(file);
+    return outputTag(output.data(), output.size());
+}
+
+string responseHeaders(int status, const char* contentType, uint64_t contentLength, const string& tag = string()) {
+    string headers = "HTTP/1.1 " + to_string(status) + " " + statusText(status) + "\r\nContent-Type: "
+        + contentType + "\r\nContent-Length: " + to_string(contentLength);
+    if (!tag.empty()) {
+        headers += "\r\nETag: " + tag;
+    }
+    return headers + "\r\nConnection: close\r\n\r\n";
+}
+
+class Server {
+public:
+    explicit Server(const ServerOptions& options) : m_options(options), m_readBuffer(readChunk) {}
+    int run();
+
+private:
+    // Bounded queue of documents waiting for a worker
+    bool enqueue(Job&& job);
+    void work();
+    Result process(const Job& job);
+    void finish(Result&& result);
+    void drainResults();
+
+    void acceptConnections();
+    void onReadable(uint64_t id, Connection& connection);
+    bool startRequest(uint64_t id, Connection& connection);
+    void readBody(uint64_t id, Connection& connection, const char* data, size_t size);
+    void startJob(uint64_t id, Connection& connection);
+    void respond(uint64_t id, Connection& connection, int status, const char* contentType, const string& body);
+    void respondFile(uint64_t id, Connection& connection, const string& file, const string& tag);
+    void startWriting(uint64_t id, Connection& connection, string&& response);
+    void onWritable(uint64_t id, Connection& connection);
+    void watch(uint64_t id, Connection& connection, uint32_t events);
+    void close(uint64_t id);
+    void closeIdle();
+    string createWorkspace();
+
+    const ServerOptions& m_options;
+    int m_epoll = -1;
+    int m_listen = -1;
+    int m_wake = -1;
+    uint64_t m_nextId = firstConnectionId;
+    unordered_map<uint64_t, Connection> m_connections;
+    vector<char> m_readBuffer;
+
+    mutex m_jobsMutex;
+    condition_variable m_jobsReady;
+    deque<Job> m_jobs;
+
+    mutex m_resultsMutex;
+    vector<Result> m_results;
+};
+
+bool Server::enqueue(Job&& job) {
+    {
+        lock_guard<mutex> lock(m_jobsMutex);
+        if (m_jobs.size() >= m_options.maxQueuedJobs) {
+            return false;
+        }
+        m_jobs.push_back(std::move(job));
+    }
+    m_jobsReady.notify_one();
+    return true;
+}
+
+void Server::work() {
+    for (;;) {
+        Job job;
+        {
+            unique_lock<mutex> lock(m_jobsMutex);
+            m_jobsReady.wait(lock, [this] { return !m_jobs.empty(); });
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        Result result = process(job);
+        {
+            lock_guard<mutex> lock(m_resultsMutex);
+            m_results.push_back(std::move(result));
+        }
+        uint64_t one = 1;
+        ssize_t ignored = write(m_wake, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+Result Server::process(const Job& job) {
+    Result result { job.connection, job.workspace, 200, "application/json", string(), string(), string() };
+    try {
+        if (job.route == Route::Download) {
+            string error;
+            if (!downloadUrl(job.url, job.input, m_options.maxBodyBytes, error)) {
+                result.status = 500;
+                result.body = jsonMessage("error", error);
+                return result;
+            }
+        }
+
+        string output = job.workspace + "/normed.pdf";
+        string message;
+        if (normalizeFileStatus(job.input, output, m_options.normalize, message) != 0) {
+            result.status = job.route == Route::Download ? 500 : 422;
+            result.body = jsonMessage("error", message);
+            return result;
+        }
+
+        if (job.route == Route::Download) {
+            publishOutput(output, job.workspace, m_options.outputDirectory);
+        }
+        result.contentType = "application/pdf";
+        result.file = output;
+        result.tag = fileTag(output);
+    } catch (const std::exception& e) {
+        result.status = 500;
+        result.body = jsonMessage("error", e.what());
+    }
+    return result;
+}
+
+void Server::drainResults() {
+    uint64_t count = 0;
+    ssize_t ignored = read(m_wake, &count, sizeof(count));
+    (void)ignored;
+
+    vector<Result> results;
+    {
+        lock_guard<mutex> lock(m_resultsMutex);
+        results.swap(m_results);
+    }
+    for (Result& result : results) {
+        finish(std::move(result));
+    }
+}
+
+void Server::finish(Result&& result) {
+    auto found = m_connections.find(result.connection);
+    if (found == m_connections.end() || found->second.gone) {
+        close(result.connection);
+        return;
+    }
+    Connection& connection = found->second;
+    if (result.file.empty()) {
+        respond(result.connection, connection, result.status, result.contentType.c_str(), result.body);
+    } else {
+        respondFile(result.connection, connection, result.file, result.tag);
+    }
+}
+
+string Server::createWorkspace() {
+    string pattern = m_options.workspaceRoot + "/pdfnorm-XXXXXX";
+    if (!mkdtemp(&pattern[0])) {
+        throw runtime_error("Cannot create a workspace under " + m_options.workspaceRoot + ": " + strerror(errno));
+    }
+    return pattern;
+}
+
+void Server::acceptConnections() {
+    for (;;) {
+        int fd = accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+        if (m_connections.size() >= m_options.maxConnections) {
+            static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            ssize_t ignored = send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+            (void)ignored;
+            ::close(fd);
+            continue;
+        }
+
+        uint64_t id = m_nextId++;
+        Connection& connection = m_connections[id];
+        connection.fd = fd;
+        connection.lastActivity = time(nullptr);
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.u64 = id;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void Server::onReadable(uint64_t id, Connection& connection) {
+    while (connection.state == Connection::ReadingHeaders || connection.state == Connection::ReadingBody) {
+        ssize_t size = recv(connection.fd, m_readBuffer.data(), m_readBuffer.size(), 0);
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (size <= 0) {
+            // The client went away before sending the whole request
+            close(id);
+            return;
+        }
+        connection.lastActivity = time(nullptr);
+
+        if (connection.state == Connection::ReadingBody) {
+            readBody(id, connection, m_readBuffer.data(), static_cast<size_t>(size));
+            continue;
+        }
+
+        connection.buffer.append(m_readBuffer.data(), static_cast<size_t>(size));
+        size_t headersEnd = connection.buffer.find("\r\n\r\n");
+        if (headersEnd == string::npos) {
+            if (connection.buffer.size() > maxHeaderBytes) {
+                respond(id, connection, 431, "application/json", jsonMessage("error", "Request headers too large"));
+            }
+            continue;
+        }
+        string body = connection.buffer.substr(headersEnd + 4);
+        connection.buffer.resize(headersEnd);
+        if (startRequest(id, connection) && !body.empty()) {
+            readBody(id, connection, body.data(), body.size());
+        }
+    }
+}
+
+bool Server::startRequest(uint64_t id, Connection& connection) {
+    const string& headers = connection.buffer;
+    size_t lineEnd = headers.find("\r\n");
+    string requestLine = headers.substr(0, lineEnd);
+    size_t methodEnd = requestLine.find(' ');
+    size_t targetEnd = methodEnd == string::npos ? string::npos : requestLine.find(' ', methodEnd + 1);
+    if (targetEnd == string::npos) {
+        respond(id, connection, 400, "application/json", jsonMessage("error", "Malformed request line"));
+        return false;
+    }
+    string method = requestLine.substr(0, methodEnd);
+    connection.target = requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+    string path = connection.target.substr(0, connection.target.find('?'));
+
+    bool hasLength = false;
+    bool chunked = false;
+    bool expectContinue = false;
+    for (size_t pos = lineEnd; pos != string::npos && pos < headers.size();) {
+        size_t next = headers.find("\r\n", pos + 2);
+        string line = headers.substr(pos + 2, next == string::npos ? string::npos : next - pos - 2);
+        pos = next;
+        size_t colon = line.find(':');
+        if (colon == string::npos) {
+            continue;
+        }
+        string name = line.substr(0, colon);
+        transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return tolower(c); });
+        string value = line.substr(line.find_first_not_of(" \t", colon + 1) == string::npos
+                                   ? line.size() : line.find_first_not_of(" \t", colon + 1));
+        if (name == "content-length") {
+            try {
+                connection.contentLength = stoull(value);
+                hasLength = true;
+            } catch (const std::logic_error&) {
+                respond(id, connection, 400, "application/json", jsonMessage("error", "Bad Content-Length"));
+                return false;
+            }
+        } else if (name == "transfer-encoding") {
+            chunked = true;
+        } else if (name == "expect") {
+            expectContinue = value.find("100-continue") != string::npos;
+        }
+    }
+
+    if (path == "/") {
+        respond(id, connection, method == "GET" ? 200 : 405, "text/plain", method == "GET" ? "Hello, World!" : "");
+        return false;
+    }
+    if (path != "/download_pdf" && path != "/normalize") {
+        respond(id, connection, 404, "application/json", jsonMessage("error", "Not found"));
+        return false;
+    }
+    if (method != "POST") {
+        respond(id, connection, 405, "application/json", jsonMessage("error", "Use POST"));
+        return false;
+    }
+    if (chunked || !hasLength) {
+        respond(id, connection, 411, "application/json", jsonMessage("error", "A Content-Length is required"));
+        return false;
+    }
+
+    connection.route = path == "/download_pdf" ? Route::Download : Route::Normalize;
+    uint64_t limit = connection.route == Route::Download ? maxJsonBytes : m_options.maxBodyBytes;
+    if (connection.contentLength > limit) {
+        respond(id, connection, 413, "application/json",
+                jsonMessage("error", "Body larger than " + to_string(limit) + " bytes"));
+        return false;
+    }
+
+    connection.buffer.clear();
+    if (connection.route == Route::Normalize) {
+        try {
+            connection.workspace = createWorkspace();
+        } catch (const std::exception& e) {
+            respond(id, connection, 500, "application/json", jsonMessage("error", e.what()));
+            return false;
+        }
+        connection.input = connection.workspace + "/" + uploadName(connection.target);
+        connection.inputFd = open(connection.input.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (connection.inputFd < 0) {
+            respond(id, connection, 500, "application/json", jsonMessage("error", "Cannot create " + connection.input));
+            return false;
+        }
+    }
+
+    if (expectContinue) {
+        static const char proceed[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        ssize_t ignored = send(connection.fd, proceed, sizeof(proceed) - 1, MSG_NOSIGNAL);
+        (void)ignored;
+    }
+    connection.state = Connection::ReadingBody;
+    if (connection.contentLength == 0) {
+        startJob(id, connection);
+    }
+    return connection.state == Connection::ReadingBody;
+}
+
+void Server::readBody(uint64_t id, Connection& connection, const char* data, size_t size) {
+    // Anything past Content-Length is ignored, every connection carries one request
+    size = static_cast<size_t>(min<uint64_t>(size, connection.contentLength - connection.received));
+    if (connection.route == Route::Normalize) {
+        for (size_t written = 0; written < size;) {
+            ssize_t count = write(connection.inputFd, data + written, size - written);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                respond(id, connection, 500, "application/json", jsonMessage("error", "Cannot write " + connection.input));
+                return;
+            }
+            written += static_cast<size_t>(count);
+        }
+    } else {
+        connection.buffer.append(data, size);
+    }
+    connection.received += size;
+    if (connection.received == connection.contentLength) {
+        startJob(id, connection);
+    }
+}
+
+void Server::startJob(uint64_t id, Connection& connection) {
+    Job job { id, connection.route, connection.workspace, connection.input, string() };
+    if (connection.route == Route::Normalize) {
+        ::close(connection.inputFd);
+        connection.inputFd = -1;
+    } else {
+        if (!jsonUrl(connection.buffer, job.url)) {
+            respond(id, connection, 400, "application/json", jsonMessage("error", "Missing URL"));
+            return;
+        }
+        try {
+            connection.workspace = createWorkspace();
+        } catch (const std::exception& e) {
+            respond(id, connection, 500, "application/json", jsonMessage("error", e.what()));
+            return;
+        }
+        // Same input name as webApp.py used, so the title doesn't change
+        job.workspace = connection.workspace;
+        job.input = connection.workspace + "/downloaded.pdf";
+    }
+
+    if (!enqueue(std::move(job))) {
+        respond(id, connection, 503, "application/json", jsonMessage("error", "Too many documents queued, try again later"));
+        return;
+    }
+    connection.state = Connection::Working;
+    connection.buffer.clear();
+    connection.buffer.shrink_to_fit();
+    watch(id, connection, 0);
+}
+
+void Server::respond(uint64_t id, Connection& connection, int status, const char* contentType, const string& body) {
+    startWriting(id, connection, responseHeaders(status, contentType, body.size()) + body);
+}
+
+void Server::respondFile(uint64_t id, Connection& connection, const string& file, const string& tag) {
+    struct stat info {};
+    connection.fileFd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (connection.fileFd < 0 || fstat(connection.fileFd, &info) != 0) {
+        respond(id, connection, 500, "application/json", jsonMessage("error", "Cannot open " + file));
+        return;
+    }
+    connection.fileSize = info.st_size;
+    connection.fileOffset = 0;
+    startWriting(id, connection, responseHeaders(200, "application/pdf", static_cast<uint64_t>(info.st_size), tag));
+}
+
+void Server::startWriting(uint64_t id, Connection& connection, string&& response) {
+    connection.response = std::move(response);
+    connection.responseSent = 0;
+    connection.state = Connection::Writing;
+    connection.lastActivity = time(nullptr);
+    watch(id, connection, EPOLLOUT);
+}
+
+void Server::onWritable(uint64_t id, Connection& connection) {
+    while (connection.responseSent < connection.response.size()) {
+        ssize_t sent = send(connection.fd, connection.response.data() + connection.responseSent,
+                            connection.response.size() - connection.responseSent, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (sent <= 0) {
+            close(id);
+            return;
+        }
+        connection.responseSent += static_cast<size_t>(sent);
+        connection.lastActivity = time(nullptr);
+    }
+    while (connection.fileFd >= 0 && connection.fileOffset < connection.fileSize) {
+        ssize_t sent = sendfile(connection.fd, connection.fileFd, &connection.fileOffset,
+                                static_cast<size_t>(connection.fileSize - connection.fileOffset));
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (sent <= 0) {
+            break;
+        }
+        connection.lastActivity = time(nullptr);
+    }
+    close(id);
+}
+
+void Server::watch(uint64_t id, Connection& connection, uint32_t events) {
+    epoll_event event {};
+    event.events = events;
+    event.data.u64 = id;
+    epoll_ctl(m_epoll, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+void Server::close(uint64_t id) {
+    auto found = m_connections.find(id);
+    if (found == m_connections.end()) {
+        return;
+    }
+    Connection& connection = found->second;
+    ::close(connection.fd);
+    if (connection.inputFd >= 0) {
+        ::close(connection.inputFd);
+    }
+    if (connection.fileFd >= 0) {
+        ::close(connection.fileFd);
+    }
+    if (!connection.workspace.empty()) {
+        std::error_code error;
+        filesystem::remove_all(connection.workspace, error);
+    }
+    m_connections.erase(found);
+}
+
+void Server::closeIdle() {
+    time_t cutoff = time(nullptr) - idleSeconds;
+    vector<uint64_t> idle;
+    for (const auto& entry : m_connections) {
+        if (entry.second.state != Connection::Working && entry.second.lastActivity < cutoff) {
+            idle.push_back(entry.first);
+        }
+    }
+    for (uint64_t id : idle) {
+        close(id);
+    }
+}
+
+int Server::run() {
+    m_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<uint16_t>(m_options.port));
+    if (m_listen < 0 || ::bind(m_listen, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || listen(m_listen, SOMAXCONN) != 0) {
+        cerr << "Cannot listen on port " << m_options.port << ": " << strerror(errno) << endl;
+        return 2;
+    }
+
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.u64 = listenId;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listen, &event);
+    event.data.u64 = wakeId;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &event);
+
+    unsigned workers = workerCount(m_options.workers);
+    for (unsigned i = 0; i < workers; i++) {
+        thread([this] { work(); }).detach();
+    }
+    cout << "Listening on port " << m_options.port << " with " << workers << " workers" << endl;
+
+    vector<epoll_event> events(256);
+    time_t lastSweep = time(nullptr);
+    for (;;) {
+        int count = epoll_wait(m_epoll, events.data(), static_cast<int>(events.size()), 1000);
+        for (int i = 0; i < count; i++) {
+            uint64_t id = events[i].data.u64;
+            if (id == listenId) {
+                acceptConnections();
+                continue;
+            }
+            if (id == wakeId) {
+                drainResults();
+                continue;
+            }
+            auto found = m_connections.find(id);
+            if (found == m_connections.end()) {
+                continue;
+            }
+            Connection& connection = found->second;
+            if (connection.state == Connection::Working) {
+                // Only a hang up gets here, the result is dropped when it comes in
+                epoll_ctl(m_epoll, EPOLL_CTL_DEL, connection.fd, nullptr);
+                connection.gone = true;
+            } else if (connection.state == Connection::Writing) {
+                onWritable(id, connection);
+            } else {
+                onReadable(id, connection);
+            }
+        }
+        if (time(nullptr) != lastSweep) {
+            lastSweep = time(nullptr);
+            closeIdle();
+        }
+    }
+}
+
+} // namespace
+
+int runServer(const ServerOptions& options) {
+    // Writes to clients that hung up fail with EPIPE instead of ending the process
+    signal(SIGPIPE, SIG_IGN);
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    Server server(options);
+    return server.run();
+}
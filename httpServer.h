@@ -0,0 +1,29 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include "normalizer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct ServerOptions {
+    int port = 5000;
+    unsigned workers = 0;                   // Normalization threads, 0 for one per hardware thread
+    size_t maxConnections = 1024;           // Open connections, new ones past this get a 503
+    size_t maxQueuedJobs = 256;             // Documents waiting for a worker, past this requests get a 503
+    uint64_t maxBodyBytes = 256ull << 20;   // Largest upload or download
+    std::string workspaceRoot = "/tmp";     // Every request gets its own directory under here
+    std::string outputDirectory = "normalized"; // Where /download_pdf leaves normed.pdf, as webApp.py did
+    NormalizeOptions normalize;
+};
+
+// Serve the webApp.py routes from one epoll loop: GET /, POST /download_pdf ({"url": ...}) and
+// POST /normalize, which takes the PDF as the request body (?name= sets the title). Both answer
+// with the normalized PDF and an ETag hashed from its bytes, errors with the same JSON messages
+// as webApp.py. Bodies go straight to disk as they arrive and answers are sent with sendfile, so
+// memory per connection stays small; the documents themselves are normalized on a pool of
+// workers, each under its own budget. Only returns when the server can't start.
+int runServer(const ServerOptions& options);
+
+#endif // HTTP_SERVER_H
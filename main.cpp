@@ -1,549 +1,283 @@
 #include <podofo/podofo.h>
+#include "analyze.h"
+#include "budget.h"
+#include "hotFolder.h"
+#include "httpServer.h"
+#include "normalizer.h"
+#include "parallel.h"
+#include "preflight.h"
+#include "zygote.h"
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
+#include <vector>
 
 
 using namespace PoDoFo;
 using namespace std;
 
-void removeJavaScript(PdfMemDocument& document) {
-    // Check if there are any document actions, print them out and remove them
-    PdfDictionary& catalog = document.GetCatalog().GetDictionary();
-
-    // Check and remove any openActions
-    if (catalog.HasKey(PdfName("OpenAction"))) {
-        catalog.RemoveKey(PdfName("OpenAction"));
-        cout << "Document OpenAction Removed" << endl;
-    }
-
-    // loop through the acroform and remove any actions
-    PdfAcroForm* acroform = document.GetAcroForm();
-    if (acroform) {
-        const unsigned int numFields = acroform->GetFieldCount();
-        for (int i=0; i< numFields; i++) {
-            PdfField& field = acroform->GetFieldAt(i);
-            PdfDictionary& dict = field.GetDictionary();
-
-            // Check if the field has any actions
-            if (dict.HasKey(PdfName("A"))) {
-                dict.RemoveKey(PdfName("A"));
+// Settings for "-" as the input or output file, which streams the document through stdin/stdout
+struct StreamOptions {
+    string title;               // Title for a document read from stdin, which has no file name
+    uint64_t maxInputBytes = 0; // Largest document accepted on stdin, 0 for no limit
+    bool printTag = false;      // Print the output's ETag line on stdout when done (file outputs only)
+};
+
+bool parseArguments(const vector<string>& arguments, NormalizeOptions& options, ServerOptions& server, bool& serve,
+                    ZygoteOptions& zygote, WatchOptions& watch, bool& analyze, string& outputDirectory,
+                    StreamOptions& streams, vector<string>& fileNames) {
+    for (const string& arg : arguments) {
+        size_t equals = arg.find('=');
+        string value = equals == string::npos ? string() : arg.substr(equals + 1);
+        try {
+            // The normalization options are shared with the library's C API
+            if (arg.rfind("--", 0) == 0 && parseNormalizeOption(arg.substr(2, equals - 2), value, options)) {
+                continue;
             }
-
-            // check if the field has any additional actions
-            if (dict.HasKey(PdfName("AA"))) {
-                dict.RemoveKey(PdfName("AA"));
+            if (arg == "--serve") {
+                serve = true;
+            } else if (arg.rfind("--serve=", 0) == 0) {
+                serve = true;
+                server.port = stoi(value);
+            } else if (arg.rfind("--workers=", 0) == 0) {
+                server.workers = static_cast<unsigned>(stoul(value));
+            } else if (arg.rfind("--max-connections=", 0) == 0) {
+                server.maxConnections = stoul(value);
+            } else if (arg.rfind("--max-queued=", 0) == 0) {
+                server.maxQueuedJobs = stoul(value);
+            } else if (arg.rfind("--max-body-bytes=", 0) == 0) {
+                server.maxBodyBytes = stoull(value);
+            } else if (arg.rfind("--output-dir=", 0) == 0) {
+                outputDirectory = value;
+            } else if (arg.rfind("--workspace=", 0) == 0) {
+                server.workspaceRoot = value;
+            } else if (arg.rfind("--zygote=", 0) == 0) {
+                zygote.socketPath = value;
+            } else if (arg.rfind("--max-jobs=", 0) == 0) {
+                zygote.maxJobs = static_cast<unsigned>(stoul(value));
+            } else if (arg.rfind("--warmup=", 0) == 0) {
+                zygote.warmupFile = value;
+            } else if (arg.rfind("--watch=", 0) == 0) {
+                watch.directory = value;
+            } else if (arg.rfind("--batch-ms=", 0) == 0) {
+                watch.batchMilliseconds = static_cast<unsigned>(stoul(value));
+            } else if (arg.rfind("--title=", 0) == 0) {
+                streams.title = value;
+            } else if (arg.rfind("--max-input-bytes=", 0) == 0) {
+                streams.maxInputBytes = stoull(value);
+            } else if (arg == "--print-etag") {
+                streams.printTag = true;
+            } else if (arg == "--analyze") {
+                analyze = true;
+            } else if (arg.rfind("--", 0) == 0) {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                return false;
+            } else {
+                fileNames.push_back(arg);
             }
+        } catch (const std::logic_error&) {
+            std::cerr << "Invalid value: " << arg << std::endl;
+            return false;
         }
     }
+    return true;
 }
 
-void clearMetadata(PdfMemDocument& document, const string& filename) {
-    std::vector<string> emptyKeywords;
-    PdfMetadata& info = document.GetMetadata();
-    info.SetAuthor(PdfString(""));
-    info.SetCreator(PdfString(""));
-    info.SetKeywords(emptyKeywords);
-    info.SetProducer(PdfString(""));
-    info.SetSubject(PdfString(""));
-
-    // set the title to the filename
-    size_t pos = filename.find_last_of(("/\\"));
-    string title = (pos == string::npos) ? filename : filename.substr(pos + 1);
-    info.SetTitle(PdfString(title));
+// Whether the arguments set --name or --name=value themselves
+bool given(const vector<string>& arguments, const string& name) {
+    for (const string& arg : arguments) {
+        if (arg == "--" + name || arg.rfind("--" + name + "=", 0) == 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
-void updateAcroform(PdfMemDocument& document) {
-    // Method to update the Default Appearance of the fields in the PDF Acroform Field Dictionary
-    PdfString update_DA = "/Helv 0 Tf 0 0 1 rg";
-    PdfString update_V = "";
-
-    // check if the acroform exists
-    PdfAcroForm* acroform = document.GetAcroForm();
-    if(!acroform) {
-        cerr << "No AcroForm found in this document." << endl;
-        return;
+// A server or hot folder normalizes workers documents side by side, so unless the arguments
+// say otherwise each one gets its share of the hardware threads instead of all of them, and no
+// progress messages, which would interleave
+void serviceDefaults(const vector<string>& arguments, unsigned workers, NormalizeOptions& options) {
+    if (!given(arguments, "threads")) {
+        options.threads = documentThreads(workers);
     }
-
-
-    // See if any fields exist in the document
-    PdfObject* fields = acroform->GetDictionary().GetKey(PdfName("Fields"));
-    if (!fields || !fields->IsArray()) {
-        cerr << "No Fields found in this document" << endl;
-        return;
+    if (!given(arguments, "verbose") && !given(arguments, "quiet")) {
+        options.verbose = false;
     }
+}
 
-
-    // Drill down into fields
-    const unsigned int numFields = acroform->GetFieldCount();
-    for (int i=0; i< numFields; i++) {
-        PdfField& field = acroform->GetFieldAt(i);
-
-        cout << field.GetDictionary().ToString() << endl;
-
-
-        // TEXT BOX EDITS
-        if (field.GetType() == PdfFieldType::TextBox) {
-            PdfDictionary& dict = field.GetDictionary();
-
-            // Check what the default appearance is and if it exists
-            // If so, replace it with the new Default Appearance
-            PdfObject* default_DA = dict.GetKey(PdfName("DA"));
-            if (default_DA) {
-                default_DA->SetString(update_DA);
-            }
-
-            // Check if there is any Text in the TextBox
-            // Update it to be blank if it does exist
-            PdfObject* default_V = dict.GetKey((PdfName("V")));
-            if (default_V) {
-                default_V->SetString(update_V);
-            }
-
-            // Check if the textbox has set border color/fill color
-            // Remove it if it exists
-            PdfObject* default_MK = dict.GetKey((PdfName("MK")));
-            if (default_MK) {
-                dict.RemoveKey(PdfName("MK"));
-            }
-
-            // Remove default appearance if it exists
-            PdfObject* default_AP = dict.GetKey(PdfName("AP"));
-            if (default_AP) {
-                // update the ap to reflect the new appearance
-                dict.RemoveKey(PdfName("AP"));
-            }
+// Read all of stdin, giving up as soon as it passes limit (0 for none)
+bool readInput(istream& input, uint64_t limit, string& data) {
+    char chunk[1 << 16];
+    while (input.read(chunk, sizeof(chunk)) || input.gcount() > 0) {
+        data.append(chunk, input.gcount());
+        if (limit > 0 && data.size() > limit) {
+            return false;
         }
-        else {
-            // CHECKBOX EDITS
-            if (field.GetType() == PdfFieldType::CheckBox) {
-                // Get the dictionary of the field
-                PdfDictionary& dict = field.GetDictionary();
-
-                // check if the field is set to yes
-                PdfObject* on = dict.GetKey(PdfName("AS"));
-                if (on && on->IsName() && on->GetName().GetString() != "Off") {
-                    dict.AddKey(PdfName("AS"), PdfName("Off"));
-                }
-
-                if (!on) {
-                    // If the button does not have a state, check if it has kids
-                    PdfObject* kids = dict.GetKey(PdfName("Kids"));
-                    if (!kids || !kids->IsArray()) {
-                        cerr << "No Kids found in this document" << endl;
-                        return;
-                    }
-
-                    // Get the kids array
-                    // If only 1 kid, replace parent with kid
-                    PdfArray& kidsArray = kids->GetArray();
-                    if (kidsArray.size() == 1) {
-                        PdfObject* pKidObj = document.GetObjects().GetObject(kidsArray[0].GetReference());
-                        if (pKidObj && pKidObj->IsDictionary()) {
-                            PdfDictionary& childDictionary = pKidObj->GetDictionary();
-                            PdfObject* child_activated = childDictionary.GetKey(PdfName("AS"));
-                            if (child_activated) {
-                                childDictionary.AddKey(PdfName("AS"), PdfName("Off"));
-                            }
-                            PdfObject* child_V = childDictionary.GetKey(PdfName("V"));
-                            if (child_V) {
-                                child_V->SetString(update_V);
-                            }
-                            PdfObject* child_MK = childDictionary.GetKey(PdfName("MK"));
-                            if (child_MK) {
-                                PdfObject* default_CA = child_MK->GetDictionary().GetKey(PdfName("CA"));
-                                // Set BC
-                                PdfArray borderColor;
-                                borderColor.Add(PdfVariant(0.0));
-                                child_MK->GetDictionary().AddKey(PdfName("BC"), borderColor);
-
-                                // Set BG
-                                PdfArray fillColor;
-                                fillColor.Add(PdfVariant(1.0));
-                                child_MK->GetDictionary().AddKey(PdfName("BG"), fillColor);
-
-                                if (default_CA) {
-                                    // Remove the CA key
-                                    child_MK->GetDictionary().RemoveKey(PdfName("CA"));
-                                }
-
-                            }
-                        }
-                    }
-                }
-
-                // Check if the field contains a V
-                if (dict.HasKey(PdfName("V"))) {
-                    dict.RemoveKey(PdfName("V"));
-                }
-
-                // Set the DA to blue
-                PdfObject* default_DA = dict.GetKey(PdfName("DA"));
-                if (default_DA) {
-                    default_DA->SetString("/Helv 0 Tf 0 0 1 rg");
-                }
-
-                // Remove MK key (inidcates if it should be specially filled
-                PdfObject* default_MK = dict.GetKey(PdfName("MK"));
-                if (default_MK) {
-                    PdfObject* default_CA = default_MK->GetDictionary().GetKey(PdfName("CA"));
-                        // Set BC
-                        PdfArray borderColor;
-                        borderColor.Add(PdfVariant(0.0));
-                        default_MK->GetDictionary().AddKey(PdfName("BC"), borderColor);
-
-                        // Set BG
-                        PdfArray fillColor;
-                        fillColor.Add(PdfVariant(1.0));
-                        default_MK->GetDictionary().AddKey(PdfName("BG"), fillColor);
-
-                    if (default_CA) {
-                        // Remove the CA key
-                        default_MK->GetDictionary().RemoveKey(PdfName("CA"));
-                    }
-                }
-                // Work with the appearance settings
-                PdfObject* default_AP = dict.GetKey(PdfName("AP"));
-                 if (default_AP) {
-                     // Get Normal appearance (N)
-                     PdfObject* default_N = default_AP->GetDictionary().GetKey(PdfName("N"));
-                     if (default_N) {
-                         // Two options for the checkbox, on and off
-                         PdfObject* default_Off = default_N->GetDictionary().GetKey(PdfName("Off"));
-                         PdfObject* default_On = default_N->GetDictionary().GetKey(PdfName("Yes"));
-
-                         if (default_Off) {
-                             // Get the object and the stream
-                             PdfObject* default_off_OBJ = document.GetObjects().GetObject(default_Off->GetReference());
-                             auto* stream = dynamic_cast<PdfObjectStream*>(default_off_OBJ->GetStream());
-
-                             ifstream file("checkBox_AP_off.txt", std::ios::binary | std::ios::ate);
-                             streamsize size = file.tellg();
-                             file.seekg(0, std::ios::beg);
-
-                             std::vector<char> buffer(size);
-                             if (!file.read(buffer.data(), size)) {
-                                 throw runtime_error("Cannot read stream");
-                             }
-
-                             bufferview bufferview1(buffer.data(), buffer.size());
-                                stream->SetData(bufferview1, false);
-
-                         }
-
-                         if (default_On) {
-                             // Get the object and the stream
-                             PdfObject* default_on_OBJ = document.GetObjects().GetObject(default_On->GetReference());
-                             auto* stream = dynamic_cast<PdfObjectStream*>(default_on_OBJ->GetStream());
-
-                             ifstream file("checkBox_AP_on.txt", std::ios::binary | std::ios::ate);
-                             streamsize size = file.tellg();
-                             file.seekg(0, std::ios::beg);
-
-                             std::vector<char> buffer(size);
-                             if (!file.read(buffer.data(), size)) {
-                                 throw runtime_error("Cannot read stream");
-                             }
-
-                             bufferview bufferview1(buffer.data(), buffer.size());
-                             stream->SetData(bufferview1, false);
-                         }
-                     }
-
-                     // Get the pressed appearance (D)
-                     PdfObject* default_D = default_AP->GetDictionary().GetKey(PdfName("D"));
-                     if (default_D) {
-
-                         // Get the two states
-                         PdfObject* default_Off = default_D->GetDictionary().GetKey(PdfName("Off"));
-                         PdfObject* default_On = default_N->GetDictionary().GetKey(PdfName("Yes"));
-
-                         if (default_Off) {
-                             // Get object and stream
-                             PdfObject* default_off_OBJ = document.GetObjects().GetObject(default_Off->GetReference());
-                             auto* stream = dynamic_cast<PdfObjectStream*>(default_off_OBJ->GetStream());
-
-                             // Get the saved stream and read into a string buffer
-                             ifstream file("checkBox_AP_off_D.txt", std::ios::binary | std::ios::ate);
-                             streamsize size = file.tellg();
-                             file.seekg(0, std::ios::beg);
-
-                             std::vector<char> buffer(size);
-                             if (!file.read(buffer.data(), size)) {
-                                 throw runtime_error("Cannot read stream");
-                             }
-
-                             bufferview bufferview1(buffer.data(), buffer.size());
-                             stream->SetData(bufferview1, false);
-                         }
-                         if (default_On) {
-                             // Get objeect and stream
-                             PdfObject* default_on_OBJ = document.GetObjects().GetObject(default_On->GetReference());
-                             auto* stream = dynamic_cast<PdfObjectStream*>(default_on_OBJ->GetStream());
-
-                             // Get the saved stream and read into a string buffer
-                             ifstream file("checkBox_AP_on_D.txt", std::ios::binary | std::ios::ate);
-                             streamsize size = file.tellg();
-                             file.seekg(0, std::ios::beg);
-
-                             std::vector<char> buffer(size);
-                             if (!file.read(buffer.data(), size)) {
-                                 throw runtime_error("Cannot read stream");
-                             }
-
-                             bufferview bufferview1(buffer.data(), buffer.size());
-                             stream->SetData(bufferview1, false);
-
-                         }
-
-                     }
-                 }
-            }
-            // RADIOBUTTON EDITS
-            if (field.GetType() == PdfFieldType::RadioButton) {
-
-                // Get the dictionary of the field
-                PdfDictionary& dict = field.GetDictionary();
-
-                // Check if the field contains a DA
-                PdfObject* default_DA = dict.GetKey(PdfName("DA"));
-                if (default_DA) {
-                    default_DA->SetString("/Helv 0 Tf 0 0 1 rg");
-                };
-
-                // check if the field contains a V
-                if (dict.HasKey(PdfName("V"))) {
-                    dict.RemoveKey(PdfName("V"));
-                }
-
-                // Each radio button field has two children objects (yes or no)
-                // We need to alter both the DA of the full button and the DA of the children
-                PdfObject* kids = dict.GetKey(PdfName("Kids"));
-                if (!kids || !kids->IsArray()) {
-                    cerr << "No Kids found in this document" << endl;
-                    return;
-                }
-
-                PdfArray& kidsArray = kids->GetArray();
-                for (const auto & j : kidsArray) {
-                    if (j.IsReference()) {
-                        PdfObject* pKidObj = document.GetObjects().GetObject(j.GetReference());
-                        if (pKidObj && pKidObj->IsDictionary()) {
-
-                            // Change the DA
-                            PdfObject* default_DAKid = pKidObj->GetDictionary().GetKey(PdfName("DA"));
-                            if (default_DAKid) {
-                                default_DAKid->SetString("/Zadb 0 Tf 0 0 1 rg");
-                            }
-
-                            // Set AS to Off
-                            PdfObject* on = pKidObj->GetDictionary().GetKey(PdfName("AS"));
-                            if (on && on->IsName() && on->GetName().GetString() != "Off") {
-                                pKidObj->GetDictionary().AddKey(PdfName("AS"), PdfName("Off"));
-                            }
-
-                            // if BS remove BS
-                            // This is border style
-                            PdfObject* default_BS = pKidObj->GetDictionary().GetKey(PdfName("BS"));
-                            if (default_BS) {
-                                pKidObj->GetDictionary().RemoveKey(PdfName("BS"));
-                            }
-
-                            // Set MK , BC and BG
-                            PdfObject* default_MK = pKidObj->GetDictionary().GetKey(PdfName("MK"));
-                            if (default_MK) {
-                                PdfObject* default_CA = default_MK->GetDictionary().GetKey(PdfName("CA"));
-                                if (default_CA) {
-                                    // Set BC
-                                    PdfArray borderColor;
-                                    borderColor.Add(PdfVariant(0.0));
-                                    default_MK->GetDictionary().AddKey(PdfName("BC"), borderColor);
-
-                                    // Set BG
-                                    PdfArray fillColor;
-                                    fillColor.Add(PdfVariant(1.0));
-                                    default_MK->GetDictionary().AddKey(PdfName("BG"), fillColor);
-
-                                    // Remove the CA key
-                                    default_MK->GetDictionary().RemoveKey(PdfName("CA"));
-                                }
-                            }
-
-                            // Get the appearance Stream
-                            PdfObject* default_AP = pKidObj->GetDictionary().GetKey(PdfName("AP"));
-                            if (default_AP) {
-
-                                // Get the normal appearance
-                                PdfObject* default_N = default_AP->GetDictionary().GetKey(PdfName("N"));
-                                if (default_N) {
-
-                                    // Get the off and on normal appearance
-                                    PdfObject* default_Off = default_N->GetDictionary().GetKey(PdfName("Off"));
-                                    PdfObject* default_On = default_N->GetDictionary().GetKey(PdfName("Yes"));
-                                    PdfObject* default_No= default_N->GetDictionary().GetKey(PdfName("No"));
-
-                                    // if they exists and are references get the object
-                                    if (default_Off && default_Off->IsReference()) {
-                                        // IMPLEMENT
-                                        // Get the object and the stream
-                                        PdfObject* default_off_OBJ = document.GetObjects().GetObject(default_Off->GetReference());
-                                        auto* stream = dynamic_cast<PdfObjectStream*>(default_off_OBJ->GetStream());
-
-                                        // Get the saved stream and read into a string buffer
-                                        ifstream file("radioButton_AP_off.txt", std::ios::binary | std::ios::ate);
-                                        streamsize size = file.tellg();
-                                        file.seekg(0, std::ios::beg);
-
-                                        std::vector<char> buffer(size);
-                                        if (!file.read(buffer.data(), size)) {
-                                            throw runtime_error("Cannot read stream");
-                                        }
-
-                                        bufferview bufferview1(buffer.data(), buffer.size());
-                                        stream->SetData(bufferview1, false);
-
-                                    }
-                                    if (default_On && default_On->IsReference()) {
-                                        // Get the obect
-                                        PdfObject* default_on_OBJ = document.GetObjects().GetObject(default_On->GetReference());
-                                        auto* stream = dynamic_cast<PdfObjectStream*>(default_on_OBJ->GetStream());
-
-
-                                        // Get the saved stream and read into a string buffer
-                                        ifstream file("radioButton_AP_yes.txt", std::ios::binary | std::ios::ate);
-                                        streamsize size = file.tellg();
-                                        file.seekg(0, std::ios::beg);
-
-                                        std::vector<char> buffer(size);
-                                        if (!file.read(buffer.data(), size)) {
-                                            throw runtime_error("Cannot read stream");
-                                        }
-
-                                        bufferview bufferview1(buffer.data(), buffer.size());
-                                        stream->SetData(bufferview1, false);
-
-                                    }
-                                    if (default_No && default_No->IsReference()) {
-                                        // Get the obect
-                                        PdfObject* default_no_OBJ = document.GetObjects().GetObject(default_No->GetReference());
-                                        auto* stream = dynamic_cast<PdfObjectStream*>(default_no_OBJ->GetStream());
-
-                                        // Get the saved stream and read into a string buffer
-                                        ifstream file("radioButton_AP_no.txt", std::ios::binary | std::ios::ate);
-                                        streamsize size = file.tellg();
-                                        file.seekg(0, std::ios::beg);
-
-                                        std::vector<char> buffer(size);
-                                        if (!file.read(buffer.data(), size)) {
-                                            throw runtime_error("Cannot read stream");
-                                        }
-
-                                        bufferview bufferview1(buffer.data(), buffer.size());
-                                        stream->SetData(bufferview1, false);
-                                    }
-                                }
-
-                                // Do the same thing for D
-                                PdfObject* default_D = default_AP->GetDictionary().GetKey(PdfName("D"));
-                                if (default_D) {
-                                    // Get the pressed appearances
-                                    PdfObject* default_Off = default_D->GetDictionary().GetKey(PdfName("Off"));
-                                    PdfObject* default_On = default_D->GetDictionary().GetKey(PdfName("Yes"));
-                                    PdfObject* default_No= default_D->GetDictionary().GetKey(PdfName("No"));
-
-                                    // if they exists and are references get the object
-                                    if (default_Off && default_Off->IsReference()) {
-                                        // IMPLEMENT
-                                        // Get the object and the stream
-                                        PdfObject* default_off_OBJ = document.GetObjects().GetObject(default_Off->GetReference());
-                                        auto* stream = dynamic_cast<PdfObjectStream*>(default_off_OBJ->GetStream());
-
-                                        // Get the saved stream and read into a string buffer
-                                        ifstream file("radioButton_AP_off.txt", std::ios::binary | std::ios::ate);
-                                        streamsize size = file.tellg();
-                                        file.seekg(0, std::ios::beg);
-
-                                        std::vector<char> buffer(size);
-                                        if (!file.read(buffer.data(), size)) {
-                                            throw runtime_error("Cannot read stream");
-                                        }
-
-                                        bufferview bufferview1(buffer.data(), buffer.size());
-                                        stream->SetData(bufferview1, false);
-
-                                    }
-                                    if (default_On && default_On->IsReference()) {
-                                        // Get the obect
-                                        PdfObject* default_on_OBJ = document.GetObjects().GetObject(default_On->GetReference());
-                                        auto* stream = dynamic_cast<PdfObjectStream*>(default_on_OBJ->GetStream());
-
-
-                                        // Get the saved stream and read into a string buffer
-                                        ifstream file("radioButton_AP_yes.txt", std::ios::binary | std::ios::ate);
-                                        streamsize size = file.tellg();
-                                        file.seekg(0, std::ios::beg);
-
-                                        std::vector<char> buffer(size);
-                                        if (!file.read(buffer.data(), size)) {
-                                            throw runtime_error("Cannot read stream");
-                                        }
+    }
+    return input.eof();
+}
 
-                                        bufferview bufferview1(buffer.data(), buffer.size());
-                                        stream->SetData(bufferview1, false);
+// "-" for the input or the output: the document goes through memory instead of PoDoFo's files
+int normalizeStreams(const string& inputFileName, const string& outputFileName, const string& outputDirectory,
+                     const StreamOptions& streams, const NormalizeOptions& options) {
+    // With the document on stdout, the progress messages move over to stderr
+    ostream pdfOutput(cout.rdbuf());
+    if (outputFileName == "-") {
+        cout.rdbuf(std::cerr.rdbuf());
+    }
 
-                                    }
-                                    if (default_No && default_No->IsReference()) {
-                                        // Get the obect
-                                        PdfObject* default_no_OBJ = document.GetObjects().GetObject(default_No->GetReference());
-                                        auto* stream = dynamic_cast<PdfObjectStream*>(default_no_OBJ->GetStream());
+    string data;
+    unique_ptr<MappedFile> file;
+    if (inputFileName == "-") {
+        if (!readInput(cin, streams.maxInputBytes, data)) {
+            std::cerr << "Input exceeds " << streams.maxInputBytes << " bytes" << std::endl;
+            return 2;
+        }
+    } else {
+        try {
+            file = make_unique<MappedFile>(inputFileName);
+        } catch (const std::exception& e) {
+            std::cerr << "Exception: " << e.what() << std::endl;
+            return 2;
+        }
+    }
+    const char* bytes = file ? file->data() : data.data();
+    size_t size = file ? file->size() : data.size();
+    string title = !streams.title.empty() || inputFileName == "-" ? streams.title : documentTitle(inputFileName);
 
-                                        // Get the saved stream and read into a string buffer
-                                        ifstream file("radioButton_AP_no.txt", std::ios::binary | std::ios::ate);
-                                        streamsize size = file.tellg();
-                                        file.seekg(0, std::ios::beg);
+    string message;
+    if (outputFileName == "-") {
+        return normalizeBufferStatus(bytes, size, title, pdfOutput, options, message);
+    }
+    ofstream output(outputDirectory + "/" + outputFileName, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        std::cerr << "Cannot open " << outputDirectory << "/" << outputFileName << std::endl;
+        return 2;
+    }
+    return normalizeBufferStatus(bytes, size, title, output, options, message);
+}
 
-                                        std::vector<char> buffer(size);
-                                        if (!file.read(buffer.data(), size)) {
-                                            throw runtime_error("Cannot read stream");
-                                        }
+// The ETag line for --print-etag, read back from the output file
+int printTag(const string& outputPath) {
+    try {
+        MappedFile output(outputPath);
+        cout << "ETag: " << outputTag(output.data(), output.size()) << endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 2;
+    }
+}
 
-                                        bufferview bufferview1(buffer.data(), buffer.size());
-                                        stream->SetData(bufferview1, false);
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+// Bring everything a document touches into this process before the zygote starts forking:
+// the appearance templates, and PoDoFo's own tables and caches by normalizing warmupFile once
+void warmUp(const NormalizeOptions& options, const string& warmupFile) {
+    try {
+        preloadTemplates(options.templateDirectory);
+    } catch (const std::exception& e) {
+        std::cerr << "Warm-up: " << e.what() << std::endl;
+    }
+    if (!warmupFile.empty()) {
+        MappedFile input(warmupFile);
+        ostringstream output;
+        string message;
+        if (normalizeBufferStatus(input.data(), input.size(), documentTitle(warmupFile), output, options, message) != 0) {
+            std::cerr << "Warm-up: " << warmupFile << " didn't normalize" << std::endl;
         }
     }
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) { // Check if there are exactly two arguments (argv[1] and argv[2])
-        std::cerr << "Usage: " << argv[0] << " <input file> <output file>" << std::endl;
+// Everything main does, also run by the zygote's children for their jobs (nested)
+int runCommandLine(const string& program, const vector<string>& arguments, bool nested) {
+    // The tool prints what it does, unless --quiet asks it not to (serving, only with --verbose)
+    NormalizeOptions options;
+    options.verbose = true;
+    ServerOptions server;
+    bool serve = false;
+    ZygoteOptions zygote;
+    WatchOptions watch;
+    bool analyze = false;
+    // The output file name is taken relative to this, normalized/ unless --output-dir says otherwise
+    string outputDirectory = "normalized";
+    StreamOptions streams;
+    vector<string> fileNames;
+    bool parsed = parseArguments(arguments, options, server, serve, zygote, watch, analyze, outputDirectory, streams,
+                                 fileNames);
+    bool service = serve || !zygote.socketPath.empty() || !watch.directory.empty();
+    bool exports = !options.manifestFile.empty() || !options.valuesFile.empty();
+    bool fileCount = analyze ? !fileNames.empty() : fileNames.size() == (service ? 0 : 2);
+    if (!parsed || !fileCount || (service && (nested || exports)) || (analyze && (service || exports))) {
+        // There must be exactly two file names (input and output), any number of files or
+        // directories to analyze, or none when serving; a zygote job can't start a server of its
+        // own, and neither a server nor an analysis has one manifest or values file to write
+        std::cerr << "Usage: " << program << " [--dedupe-streams] [--no-preflight] [--repair=auto|always|never]"
+                  << " [--threads=N] [--timings] [--quiet] [--templates=DIR] [--max-wall-seconds=N] [--max-cpu-seconds=N]"
+                  << " [--max-decoded-bytes=N] [--max-heap-bytes=N] [--manifest=FILE]"
+                  << " [--values=FILE] [--values-format=ndjson|csv] [--marker-key=HEX] [--output-dir=DIR] <input file> <output file>" << std::endl;
+        std::cerr << "       (\"-\" reads the input from stdin or writes the output to stdout, with [--title=TITLE]"
+                  << " [--max-input-bytes=N]; [--print-etag] prints the output's ETag when done)" << std::endl;
+        std::cerr << "       " << program << " --analyze [--threads=N] [normalization options] <file or directory>..."
+                  << std::endl;
+        std::cerr << "       " << program << " --serve[=PORT] [--workers=N] [--max-connections=N] [--max-queued=N]"
+                  << " [--max-body-bytes=N] [--workspace=DIR] [normalization options]" << std::endl;
+        std::cerr << "       " << program << " --watch=DIR [--workers=N] [--batch-ms=N] [--output-dir=DIR]"
+                  << " [normalization options]" << std::endl;
+        std::cerr << "       " << program << " --zygote=SOCKET [--max-jobs=N] [--warmup=FILE] [normalization options]"
+                  << std::endl;
         return 1;
     }
 
-    const char* inputFileName = argv[1];
-    const char* outputFileName = argv[2];
+    if (!zygote.socketPath.empty()) {
+        // Each job brings its own arguments, these options only shape the warm-up
+        warmUp(options, zygote.warmupFile);
+        return runZygote(zygote, [&program](const vector<string>& jobArguments) {
+            return runCommandLine(program, jobArguments, true);
+        });
+    }
 
-    try{
-        PdfMemDocument doc;
-        doc.Load(inputFileName);
-        updateAcroform(doc);
-        removeJavaScript(doc);
-        clearMetadata(doc, inputFileName);
+    if (analyze) {
+        // A corpus gets the limits per document, like the server
+        return runAnalyze(fileNames, options);
+    }
 
-        // Save the document in a subfolder called normalized
-        string outfile = "normalized/" + string(outputFileName);
-        doc.Save(outfile);
+    if (!watch.directory.empty()) {
+        // Per document limits through the budgets here too, and --workers sizes the pool
+        serviceDefaults(arguments, server.workers, options);
+        watch.normalize = options;
+        watch.outputDirectory = outputDirectory;
+        watch.workers = server.workers;
+        return runWatch(watch);
+    }
 
+    if (serve) {
+        // The limits apply to each document through its budget; the process wide backstops
+        // would take the whole server down with one document
+        serviceDefaults(arguments, server.workers, options);
+        server.normalize = options;
+        server.outputDirectory = outputDirectory;
+        return runServer(server);
+    }
 
-    }catch (const PdfError& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
-    } catch (const std::exception& e) {
-        std::cerr << "Exception: " << e.what() << std::endl;
+    const string& inputFileName = fileNames[0];
+    const string& outputFileName = fileNames[1];
+
+    enforceProcessLimits(options.limits);
+
+    int status = 0;
+    if (inputFileName == "-" || outputFileName == "-") {
+        status = normalizeStreams(inputFileName, outputFileName, outputDirectory, streams, options);
+    } else {
+        string message;
+        status = normalizeFileStatus(inputFileName, outputDirectory + "/" + outputFileName, options, message);
     }
-    return 0;
-}
\ No newline at end of file
+    if (status == 0 && streams.printTag && outputFileName != "-") {
+        status = printTag(outputDirectory + "/" + outputFileName);
+    }
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    return runCommandLine(argv[0], vector<string>(argv + 1, argv + argc), false);
+}
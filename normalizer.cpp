@@ -0,0 +1,1692 @@
+#include "normalizer.h"
+#include "parallel.h"
+#include "preflight.h"
+#include "xrefRepair.h"
+#include <zlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+using namespace PoDoFo;
+using namespace std;
+
+namespace {
+
+uint64_t hashBytes(const char* data, size_t size) {
+    // 64 bit FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char* end = data + size; data < end; data++) {
+        hash ^= static_cast<unsigned char>(*data);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t hashBytes(const string& data) {
+    return hashBytes(data.data(), data.size());
+}
+
+// Bump when a change to the normalization rules or templates changes the output
+const char* const normalizerVersion = "pdfnorm/2";
+
+// The marker goes on the catalog with its seal still zero, sealOutput() fills it in after the
+// save. A marker the metadata only update left in /Info would be the last one in the file, so it goes.
+void stampMarker(PdfMemDocument& document, const string& marker) {
+    document.GetCatalog().GetDictionary().AddKey(PdfName(normalizedMarkerKey), PdfString(sealPlaceholder(marker)));
+    PdfObject* info = document.GetTrailer().GetDictionary().FindKey(PdfName("Info"));
+    if (info && info->IsDictionary()) {
+        info->GetDictionary().RemoveKey(PdfName(normalizedMarkerKey));
+    }
+}
+
+// Progress messages and errors only go out while a document with NormalizeOptions::verbose
+// runs on this thread (the command line tool), the library stays silent otherwise
+thread_local bool verboseThread = false;
+
+class VerboseScope {
+public:
+    explicit VerboseScope(bool verbose) : m_previous(verboseThread) {
+        verboseThread = verbose;
+    }
+    ~VerboseScope() {
+        verboseThread = m_previous;
+    }
+    VerboseScope(const VerboseScope&) = delete;
+    VerboseScope& operator=(const VerboseScope&) = delete;
+
+private:
+    bool m_previous;
+};
+
+ostream& discarded() {
+    // No buffer, so everything written to it is dropped
+    thread_local ostream discard(nullptr);
+    return discard;
+}
+
+ostream& progress() {
+    return verboseThread ? cout : discarded();
+}
+
+ostream& diagnostics() {
+    return verboseThread ? std::cerr : discarded();
+}
+
+uint64_t referenceKey(const PdfReference& reference) {
+    return (static_cast<uint64_t>(reference.ObjectNumber()) << 16) | reference.GenerationNumber();
+}
+
+// Call visit on every reference held by an object, including the ones nested in its
+// direct dictionaries and arrays. Referenced objects are not followed.
+template <typename Visitor>
+void forEachReference(PdfObject& object, Visitor&& visit) {
+    vector<PdfObject*> pending { &object };
+    while (!pending.empty()) {
+        PdfObject* current = pending.back();
+        pending.pop_back();
+
+        if (current->IsReference()) {
+            visit(*current);
+        } else if (current->IsDictionary()) {
+            for (auto& entry : current->GetDictionary()) {
+                pending.push_back(&entry.second);
+            }
+        } else if (current->IsArray()) {
+            for (auto& item : current->GetArray()) {
+                pending.push_back(&item);
+            }
+        }
+    }
+}
+
+// Action types that run code, launch or fetch something outside the document, or send data out
+const unordered_set<string> activeActionTypes = {
+    "JavaScript", "Launch", "SubmitForm", "ImportData", "GoToR", "GoToE",
+    "Rendition", "RichMediaExecute", "Sound", "Movie"
+};
+
+struct ActiveContentStats {
+    map<string, size_t> actions;
+    size_t triggers = 0;
+    bool openAction = false;
+};
+
+string activeActionType(const PdfDictionary& dict) {
+    const PdfObject* type = dict.GetKey(PdfName("S"));
+    if (!type || !type->IsName()) {
+        return string();
+    }
+    string name(type->GetName().GetString());
+    return activeActionTypes.count(name) ? name : string();
+}
+
+// With apply false nothing is removed, stats only count what would be (--analyze)
+void stripActiveContent(PdfDictionary& dict, ActiveContentStats& stats, bool apply) {
+    // An active action is emptied in place, so whatever still points at it (a /Next chain,
+    // a name tree entry, a link) ends up with a dictionary that does nothing
+    string actionType = activeActionType(dict);
+    if (!actionType.empty()) {
+        if (apply) {
+            vector<PdfName> keys;
+            for (const auto& entry : dict) {
+                keys.push_back(entry.first);
+            }
+            for (const PdfName& key : keys) {
+                dict.RemoveKey(key);
+            }
+        }
+        stats.actions[actionType]++;
+        return;
+    }
+
+    // Additional actions on pages, annotations, fields and the catalog, the document level
+    // /JavaScript name tree and XFA (which carries its own scripts) are removed outright
+    for (const char* trigger : { "AA", "JavaScript", "XFA" }) {
+        if (dict.HasKey(PdfName(trigger))) {
+            if (apply) {
+                dict.RemoveKey(PdfName(trigger));
+            }
+            stats.triggers++;
+        }
+    }
+
+    // Fields and widgets lose any action, other annotations and outline items only active ones
+    PdfObject* action = dict.GetKey(PdfName("A"));
+    if (action) {
+        const PdfObject* subtype = dict.GetKey(PdfName("Subtype"));
+        bool isField = dict.HasKey(PdfName("FT")) || (subtype && subtype->IsName() && subtype->GetName() == "Widget");
+        if (isField || (action->IsDictionary() && !activeActionType(action->GetDictionary()).empty())) {
+            if (apply) {
+                dict.RemoveKey(PdfName("A"));
+            }
+            stats.triggers++;
+        }
+    }
+}
+
+ActiveContentStats sweepActiveContent(PdfMemDocument& document, bool apply) {
+    ActiveContentStats stats;
+    PdfDictionary& catalog = document.GetCatalog().GetDictionary();
+    if (catalog.HasKey(PdfName("OpenAction"))) {
+        if (apply) {
+            catalog.RemoveKey(PdfName("OpenAction"));
+        }
+        stats.openAction = true;
+    }
+
+    // One linear pass over the object table, looking at every dictionary once (including the
+    // direct ones nested inside an object) instead of walking the page, field and name trees
+    vector<PdfObject*> pending;
+    for (PdfObject* object : document.GetObjects()) {
+        checkBudget("active content removal");
+        pending.push_back(object);
+        while (!pending.empty()) {
+            PdfObject* current = pending.back();
+            pending.pop_back();
+
+            if (current->IsArray()) {
+                for (auto& item : current->GetArray()) {
+                    if (item.IsDictionary() || item.IsArray()) {
+                        pending.push_back(&item);
+                    }
+                }
+            } else if (current->IsDictionary()) {
+                PdfDictionary& dict = current->GetDictionary();
+                stripActiveContent(dict, stats, apply);
+                for (auto& entry : dict) {
+                    if (entry.second.IsDictionary() || entry.second.IsArray()) {
+                        pending.push_back(&entry.second);
+                    }
+                }
+            }
+        }
+    }
+    return stats;
+}
+
+void removeJavaScript(PdfMemDocument& document) {
+    // Remove every document action, printing what went
+    ActiveContentStats stats = sweepActiveContent(document, true);
+    if (stats.openAction) {
+        progress() << "Document OpenAction Removed" << endl;
+    }
+    for (const auto& action : stats.actions) {
+        progress() << action.second << " " << action.first << " action(s) neutralized" << endl;
+    }
+    if (stats.triggers > 0) {
+        progress() << stats.triggers << " action trigger(s) removed" << endl;
+    }
+}
+
+// Charge what a stream decodes to before PoDoFo decodes it, from its raw data
+void chargeStream(PdfObject& object, const char* stage) {
+    charbuff raw = object.GetStream()->GetCopy(true);
+    const PdfObject* filter = object.GetDictionary().FindKey(PdfName("Filter"));
+    if (filter && filter->IsArray()) {
+        // The first filter in the chain is the one applied to the raw data
+        const PdfArray& filters = filter->GetArray();
+        filter = filters.GetSize() > 0 ? &*filters.begin() : nullptr;
+    }
+    if (filter && filter->IsName() && filter->GetName() == "FlateDecode") {
+        chargeInflatedBytes(raw.data(), raw.size(), stage);
+    } else {
+        chargeDecodedBytes(raw.size(), stage);
+    }
+}
+
+void clearMetadata(PdfMemDocument& document, const string& filename) {
+    // PdfMetadata reads the catalog's XMP packet, the one stream PoDoFo decodes for us here
+    PdfObject* xmp = document.GetCatalog().GetDictionary().FindKey(PdfName("Metadata"));
+    if (xmp && xmp->HasStream()) {
+        chargeStream(*xmp, "metadata");
+    }
+
+    std::vector<string> emptyKeywords;
+    PdfMetadata& info = document.GetMetadata();
+    info.SetAuthor(PdfString(""));
+    info.SetCreator(PdfString(""));
+    info.SetKeywords(emptyKeywords);
+    info.SetProducer(PdfString(""));
+    info.SetSubject(PdfString(""));
+
+    // set the title to the filename
+    info.SetTitle(PdfString(documentTitle(filename)));
+
+    // The catalog's XMP packet carries the same fields and more, it goes as a whole
+    document.GetCatalog().GetDictionary().RemoveKey(PdfName("Metadata"));
+}
+
+// Appearance stream templates (the *_AP_*.txt files), read and deflated once per process
+// so every widget gets the same pre-compressed bytes and the save does no per-widget compression
+struct AppearanceTemplate {
+    string raw;
+    string deflated;
+};
+
+string deflateBuffer(const string& input) {
+    uLongf size = compressBound(input.size());
+    string output(size, '\0');
+    int status = compress2(reinterpret_cast<Bytef*>(&output[0]), &size,
+                           reinterpret_cast<const Bytef*>(input.data()), input.size(), Z_BEST_COMPRESSION);
+    if (status != Z_OK) {
+        throw runtime_error("Cannot deflate stream");
+    }
+    output.resize(size);
+    return output;
+}
+
+const AppearanceTemplate& getTemplate(const string& filename) {
+    // Shared by every document in the process, entries never move once inserted so the
+    // returned reference stays valid after the lock is released
+    static mutex templatesMutex;
+    static map<string, AppearanceTemplate> templates;
+    lock_guard<mutex> lock(templatesMutex);
+    auto cached = templates.find(filename);
+    if (cached != templates.end()) {
+        return cached->second;
+    }
+
+    ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw runtime_error("Cannot open appearance template " + filename);
+    }
+    streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    AppearanceTemplate appearance;
+    appearance.raw.resize(size);
+    if (!file.read(&appearance.raw[0], size)) {
+        throw runtime_error("Cannot read stream");
+    }
+    appearance.deflated = deflateBuffer(appearance.raw);
+    return templates.emplace(filename, std::move(appearance)).first->second;
+}
+
+// Every template the field normalizers can ask for
+const char* const templateFiles[] = {
+    "checkBox_AP_off.txt", "checkBox_AP_on.txt", "checkBox_AP_off_D.txt", "checkBox_AP_on_D.txt",
+    "radioButton_AP_off.txt", "radioButton_AP_yes.txt", "radioButton_AP_no.txt",
+};
+
+string templatePath(const string& templateDirectory, const char* filename) {
+    return templateDirectory.empty() ? filename : templateDirectory + "/" + filename;
+}
+
+void installTemplate(PdfMemDocument& document, const PdfReference& appearance, const string& filename) {
+    // Replace the stream behind an appearance reference with the pre-deflated template
+    PdfObject* appearanceObj = document.GetObjects().GetObject(appearance);
+    if (!appearanceObj || !appearanceObj->HasStream()) {
+        return;
+    }
+
+    const AppearanceTemplate& appearanceTemplate = getTemplate(filename);
+    // Old decode parameters do not apply to the template bytes
+    appearanceObj->GetDictionary().RemoveKey(PdfName("DecodeParms"));
+    bufferview deflated(appearanceTemplate.deflated.data(), appearanceTemplate.deflated.size());
+    appearanceObj->GetStream()->SetData(deflated, { PdfFilterType::FlateDecode }, true);
+}
+
+// Appearance stream to replace with a template. Many widgets usually share the same few
+// streams, so the field normalizers only record these and applyTemplates() installs them
+// afterwards, in field order, on one thread.
+struct TemplateInstall {
+    PdfReference appearance;
+    const char* filename;
+};
+
+// A terminal field and the widget annotations that display it. A field without widget kids
+// is merged with its widget, so the field dictionary is its own (only) widget.
+struct TerminalField {
+    PdfObject* field;
+    PdfFieldType type;
+    vector<PdfObject*> widgets;
+    string name;        // Fully qualified, the partial names (/T) from the root field down joined with dots
+    int64_t flags;      // /Ff, which may be inherited
+};
+
+PdfFieldType fieldType(const string& type, int64_t flags) {
+    if (type == "Tx") {
+        return PdfFieldType::TextBox;
+    }
+    if (type == "Btn") {
+        if (flags & (1 << 16)) {
+            return PdfFieldType::PushButton;
+        }
+        return (flags & (1 << 15)) ? PdfFieldType::RadioButton : PdfFieldType::CheckBox;
+    }
+    if (type == "Ch") {
+        return (flags & (1 << 17)) ? PdfFieldType::ComboBox : PdfFieldType::ListBox;
+    }
+    if (type == "Sig") {
+        return PdfFieldType::Signature;
+    }
+    return PdfFieldType::Unknown;
+}
+
+vector<TerminalField> collectFields(PdfMemDocument& document, PdfArray& fields) {
+    // Walk the whole field hierarchy with an explicit stack. Every object is entered at most
+    // once (tracked by object number), so shared or cyclic /Kids in a hostile file can't make
+    // the walk loop or blow up, and the cost stays linear in the number of objects.
+    struct Pending {
+        PdfObject* node;
+        string type;      // /FT and /Ff are inherited from the parent field
+        int64_t flags;
+        string name;      // Fully qualified name of the parent field
+    };
+
+    PdfIndirectObjectList& objects = document.GetObjects();
+    vector<bool> visited;
+    auto firstVisit = [&visited](const PdfObject& object) {
+        size_t number = object.GetIndirectReference().ObjectNumber();
+        if (number >= visited.size()) {
+            visited.resize(max(number + 1, visited.size() * 2), false);
+        }
+        if (visited[number]) {
+            return false;
+        }
+        visited[number] = true;
+        return true;
+    };
+    auto resolve = [&objects](const PdfObject& item) -> PdfObject* {
+        if (!item.IsReference()) {
+            return nullptr;
+        }
+        PdfObject* object = objects.GetObject(item.GetReference());
+        return object && object->IsDictionary() ? object : nullptr;
+    };
+
+    vector<TerminalField> terminals;
+    vector<Pending> pending;
+    vector<PdfObject*> children;
+    // Children are pushed in reverse so fields come off the stack in document order
+    auto pushChildren = [&pending, &children](const string& type, int64_t flags, const string& name) {
+        for (auto child = children.rbegin(); child != children.rend(); ++child) {
+            pending.push_back({ *child, type, flags, name });
+        }
+        children.clear();
+    };
+
+    for (const PdfObject& item : fields) {
+        PdfObject* field = resolve(item);
+        if (field && firstVisit(*field)) {
+            children.push_back(field);
+        }
+    }
+    pushChildren(string(), 0, string());
+
+    while (!pending.empty()) {
+        checkBudget("field traversal");
+        Pending current = pending.back();
+        pending.pop_back();
+        PdfDictionary& dict = current.node->GetDictionary();
+
+        const PdfObject* ft = dict.GetKey(PdfName("FT"));
+        string type = ft && ft->IsName() ? string(ft->GetName().GetString()) : current.type;
+        const PdfObject* ff = dict.GetKey(PdfName("Ff"));
+        int64_t flags = ff && ff->IsNumber() ? ff->GetNumber() : current.flags;
+        string name = current.name;
+        const PdfObject* partial = dict.GetKey(PdfName("T"));
+        if (partial && partial->IsString()) {
+            name += (name.empty() ? "" : ".") + partial->GetString().GetString();
+        }
+
+        TerminalField terminal { current.node, fieldType(type, flags), {}, name, flags };
+        const PdfObject* kids = dict.FindKey(PdfName("Kids"));
+        if (kids && kids->IsArray()) {
+            for (const PdfObject& item : kids->GetArray()) {
+                PdfObject* kid = resolve(item);
+                if (!kid || !firstVisit(*kid)) {
+                    continue;
+                }
+                // Kids with a partial name are fields of their own, the others are widgets
+                if (kid->GetDictionary().HasKey(PdfName("T"))) {
+                    children.push_back(kid);
+                } else {
+                    terminal.widgets.push_back(kid);
+                }
+            }
+        }
+
+        bool hasFieldKids = !children.empty();
+        pushChildren(type, flags, name);
+        if (!hasFieldKids && terminal.widgets.empty()) {
+            terminal.widgets.push_back(current.node);
+        }
+        if (!terminal.widgets.empty()) {
+            terminals.push_back(std::move(terminal));
+        }
+    }
+    return terminals;
+}
+
+// Forms with fewer terminal fields are normalized on the calling thread, sharding them costs more
+const size_t parallelFieldThreshold = 2048;
+
+// Appearance template for one appearance state (/Off, /Yes, ...) of a button
+struct StateTemplate {
+    const char* state;
+    const char* filename;
+};
+
+void installAppearances(vector<TemplateInstall>& installs, PdfDictionary& widget, const char* appearance,
+                        initializer_list<StateTemplate> templates) {
+    // appearance is the normal (N) or down (D) entry of the widget's /AP
+    PdfObject* default_AP = widget.FindKey(PdfName("AP"));
+    if (!default_AP || !default_AP->IsDictionary()) {
+        return;
+    }
+    PdfObject* states = default_AP->GetDictionary().FindKey(PdfName(appearance));
+    if (!states || !states->IsDictionary()) {
+        return;
+    }
+    for (const StateTemplate& stateTemplate : templates) {
+        const PdfObject* state = states->GetDictionary().GetKey(PdfName(stateTemplate.state));
+        if (state && state->IsReference()) {
+            installs.push_back({ state->GetReference(), stateTemplate.filename });
+        }
+    }
+}
+
+void setDefaultAppearance(PdfDictionary& dict, const PdfString& appearance) {
+    // Only replaced where the field or widget already has one
+    PdfObject* default_DA = dict.GetKey(PdfName("DA"));
+    if (default_DA) {
+        default_DA->SetString(appearance);
+    }
+}
+
+void setStateOff(PdfDictionary& widget) {
+    PdfObject* on = widget.GetKey(PdfName("AS"));
+    if (on && on->IsName() && on->GetName().GetString() != "Off") {
+        widget.AddKey(PdfName("AS"), PdfName("Off"));
+    }
+}
+
+void setBorderColors(PdfDictionary& mk) {
+    // Set BC
+    PdfArray borderColor;
+    borderColor.Add(PdfVariant(0.0));
+    mk.AddKey(PdfName("BC"), borderColor);
+
+    // Set BG
+    PdfArray fillColor;
+    fillColor.Add(PdfVariant(1.0));
+    mk.AddKey(PdfName("BG"), fillColor);
+
+    // Remove the CA key
+    if (mk.HasKey(PdfName("CA"))) {
+        mk.RemoveKey(PdfName("CA"));
+    }
+}
+
+void normalizeTextBox(TerminalField& terminal) {
+    PdfDictionary& dict = terminal.field->GetDictionary();
+
+    // Replace the default appearance and blank any text in the field
+    setDefaultAppearance(dict, "/Helv 0 Tf 0 0 1 rg");
+    PdfObject* default_V = dict.GetKey(PdfName("V"));
+    if (default_V) {
+        default_V->SetString("");
+    }
+
+    for (PdfObject* widget : terminal.widgets) {
+        PdfDictionary& widgetDict = widget->GetDictionary();
+        setDefaultAppearance(widgetDict, "/Helv 0 Tf 0 0 1 rg");
+
+        // Remove border color/fill color and the appearance, viewers regenerate it from DA
+        if (widgetDict.HasKey(PdfName("MK"))) {
+            widgetDict.RemoveKey(PdfName("MK"));
+        }
+        if (widgetDict.HasKey(PdfName("AP"))) {
+            widgetDict.RemoveKey(PdfName("AP"));
+        }
+    }
+}
+
+void normalizeCheckBox(TerminalField& terminal, vector<TemplateInstall>& installs) {
+    PdfDictionary& dict = terminal.field->GetDictionary();
+
+    // Clear the value and set the DA to blue
+    if (dict.HasKey(PdfName("V"))) {
+        dict.RemoveKey(PdfName("V"));
+    }
+    setDefaultAppearance(dict, "/Helv 0 Tf 0 0 1 rg");
+
+    for (PdfObject* widget : terminal.widgets) {
+        PdfDictionary& widgetDict = widget->GetDictionary();
+        setStateOff(widgetDict);
+        if (widget != terminal.field && widgetDict.HasKey(PdfName("V"))) {
+            widgetDict.RemoveKey(PdfName("V"));
+        }
+
+        PdfObject* default_MK = widgetDict.FindKey(PdfName("MK"));
+        if (default_MK && default_MK->IsDictionary()) {
+            setBorderColors(default_MK->GetDictionary());
+        }
+
+        // Two states for the checkbox, on and off, in the normal and pressed appearance
+        installAppearances(installs, widgetDict, "N", {
+            { "Off", "checkBox_AP_off.txt" },
+            { "Yes", "checkBox_AP_on.txt" },
+        });
+        installAppearances(installs, widgetDict, "D", {
+            { "Off", "checkBox_AP_off_D.txt" },
+            { "Yes", "checkBox_AP_on_D.txt" },
+        });
+    }
+}
+
+void normalizeRadioButton(TerminalField& terminal, vector<TemplateInstall>& installs) {
+    PdfDictionary& dict = terminal.field->GetDictionary();
+
+    // Set the DA of the full button and clear the chosen option
+    setDefaultAppearance(dict, "/Helv 0 Tf 0 0 1 rg");
+    if (dict.HasKey(PdfName("V"))) {
+        dict.RemoveKey(PdfName("V"));
+    }
+
+    // Each option of the radio button is a widget (yes or no)
+    for (PdfObject* widget : terminal.widgets) {
+        PdfDictionary& widgetDict = widget->GetDictionary();
+        setDefaultAppearance(widgetDict, "/Zadb 0 Tf 0 0 1 rg");
+        setStateOff(widgetDict);
+
+        // if BS remove BS
+        // This is border style
+        if (widgetDict.HasKey(PdfName("BS"))) {
+            widgetDict.RemoveKey(PdfName("BS"));
+        }
+
+        PdfObject* default_MK = widgetDict.FindKey(PdfName("MK"));
+        if (default_MK && default_MK->IsDictionary() && default_MK->GetDictionary().HasKey(PdfName("CA"))) {
+            setBorderColors(default_MK->GetDictionary());
+        }
+
+        for (const char* appearance : { "N", "D" }) {
+            installAppearances(installs, widgetDict, appearance, {
+                { "Off", "radioButton_AP_off.txt" },
+                { "Yes", "radioButton_AP_yes.txt" },
+                { "No", "radioButton_AP_no.txt" },
+            });
+        }
+    }
+}
+
+void normalizeField(TerminalField& terminal, vector<TemplateInstall>& installs) {
+    switch (terminal.type) {
+        case PdfFieldType::TextBox:
+            normalizeTextBox(terminal);
+            break;
+        case PdfFieldType::CheckBox:
+            normalizeCheckBox(terminal, installs);
+            break;
+        case PdfFieldType::RadioButton:
+            normalizeRadioButton(terminal, installs);
+            break;
+        default:
+            break;
+    }
+}
+
+// What the field normalizers above would change, counted without changing anything (--analyze).
+// Keep the two in step.
+
+bool hasKey(const PdfDictionary& dict, const char* key) {
+    return dict.HasKey(PdfName(key));
+}
+
+bool stateOn(const PdfDictionary& widget) {
+    const PdfObject* on = widget.GetKey(PdfName("AS"));
+    return on && on->IsName() && on->GetName().GetString() != "Off";
+}
+
+// Appearance streams under a widget's /AP, all of which go when the /AP is removed
+size_t appearanceStreams(const PdfDictionary& widget) {
+    const PdfObject* appearance = widget.FindKey(PdfName("AP"));
+    if (!appearance || !appearance->IsDictionary()) {
+        return 0;
+    }
+    size_t streams = 0;
+    for (const auto& entry : appearance->GetDictionary()) {
+        if (entry.second.IsReference()) {
+            streams++;
+        } else if (entry.second.IsDictionary()) {
+            streams += entry.second.GetDictionary().GetSize();
+        }
+    }
+    return streams;
+}
+
+// Mirrors installAppearances(), the states that would get a template
+size_t templateStates(const PdfDictionary& widget, const char* appearance, initializer_list<const char*> states) {
+    const PdfObject* default_AP = widget.FindKey(PdfName("AP"));
+    if (!default_AP || !default_AP->IsDictionary()) {
+        return 0;
+    }
+    const PdfObject* stateDict = default_AP->GetDictionary().FindKey(PdfName(appearance));
+    if (!stateDict || !stateDict->IsDictionary()) {
+        return 0;
+    }
+    size_t found = 0;
+    for (const char* state : states) {
+        const PdfObject* stream = stateDict->GetDictionary().GetKey(PdfName(state));
+        found += stream && stream->IsReference() ? 1 : 0;
+    }
+    return found;
+}
+
+void countFieldChanges(const TerminalField& terminal, DocumentAnalysis& analysis) {
+    const PdfDictionary& dict = terminal.field->GetDictionary();
+    analysis.fields++;
+    analysis.widgets += terminal.widgets.size();
+    auto edit = [&analysis](bool changes) {
+        analysis.fieldEdits += changes ? 1 : 0;
+        return changes;
+    };
+
+    switch (terminal.type) {
+        case PdfFieldType::TextBox: {
+            analysis.textBoxes++;
+            edit(hasKey(dict, "DA"));
+            const PdfObject* value = dict.GetKey(PdfName("V"));
+            if (edit(value != nullptr) && !(value->IsString() && value->GetString().GetString().empty())) {
+                analysis.valuesCleared++;
+            }
+            for (const PdfObject* widget : terminal.widgets) {
+                const PdfDictionary& widgetDict = widget->GetDictionary();
+                edit(hasKey(widgetDict, "DA"));
+                edit(hasKey(widgetDict, "MK"));
+                if (edit(hasKey(widgetDict, "AP"))) {
+                    analysis.appearanceStreams += appearanceStreams(widgetDict);
+                }
+            }
+            break;
+        }
+        case PdfFieldType::CheckBox:
+            analysis.checkBoxes++;
+            analysis.valuesCleared += edit(hasKey(dict, "V")) ? 1 : 0;
+            edit(hasKey(dict, "DA"));
+            for (const PdfObject* widget : terminal.widgets) {
+                const PdfDictionary& widgetDict = widget->GetDictionary();
+                analysis.statesReset += edit(stateOn(widgetDict)) ? 1 : 0;
+                edit(widget != terminal.field && hasKey(widgetDict, "V"));
+                const PdfObject* default_MK = widgetDict.FindKey(PdfName("MK"));
+                edit(default_MK && default_MK->IsDictionary());
+                size_t states = templateStates(widgetDict, "N", { "Off", "Yes" }) +
+                                templateStates(widgetDict, "D", { "Off", "Yes" });
+                analysis.appearanceStreams += states;
+                analysis.fieldEdits += states;
+            }
+            break;
+        case PdfFieldType::RadioButton:
+            analysis.radioGroups++;
+            edit(hasKey(dict, "DA"));
+            analysis.valuesCleared += edit(hasKey(dict, "V")) ? 1 : 0;
+            for (const PdfObject* widget : terminal.widgets) {
+                const PdfDictionary& widgetDict = widget->GetDictionary();
+                edit(hasKey(widgetDict, "DA"));
+                analysis.statesReset += edit(stateOn(widgetDict)) ? 1 : 0;
+                edit(hasKey(widgetDict, "BS"));
+                const PdfObject* default_MK = widgetDict.FindKey(PdfName("MK"));
+                edit(default_MK && default_MK->IsDictionary() && default_MK->GetDictionary().HasKey(PdfName("CA")));
+                size_t states = 0;
+                for (const char* appearance : { "N", "D" }) {
+                    states += templateStates(widgetDict, appearance, { "Off", "Yes", "No" });
+                }
+                analysis.appearanceStreams += states;
+                analysis.fieldEdits += states;
+            }
+            break;
+        default:
+            analysis.otherFields++;
+            break;
+    }
+}
+
+// Indirect objects the field normalizers may read or change for one field: the field, its
+// widgets and whatever their AP (down to the /N and /D state dictionaries), MK, DA, V, AS and BS
+// entries point at. Appearance streams aren't included, the workers only read their references
+// and they change through applyTemplates().
+// PoDoFo parses an object on its first use, through the document's one input device, so every
+// object followed here is parsed on the calling thread before the workers start.
+vector<uint32_t> touchedObjects(PdfIndirectObjectList& objects, const TerminalField& terminal) {
+    vector<uint32_t> touched;
+    auto follow = [&objects, &touched](PdfObject* value) -> PdfObject* {
+        if (!value || !value->IsReference()) {
+            return value;
+        }
+        touched.push_back(value->GetReference().ObjectNumber());
+        PdfObject* target = objects.GetObject(value->GetReference());
+        if (target) {
+            // Asking for the type is what makes PoDoFo parse it
+            target->GetDataType();
+        }
+        return target;
+    };
+
+    vector<PdfObject*> dicts { terminal.field };
+    dicts.insert(dicts.end(), terminal.widgets.begin(), terminal.widgets.end());
+    for (PdfObject* object : dicts) {
+        touched.push_back(object->GetIndirectReference().ObjectNumber());
+        PdfDictionary& dict = object->GetDictionary();
+        for (const char* key : { "MK", "DA", "V", "AS", "BS" }) {
+            follow(dict.GetKey(PdfName(key)));
+        }
+        PdfObject* appearance = follow(dict.GetKey(PdfName("AP")));
+        if (!appearance || !appearance->IsDictionary()) {
+            continue;
+        }
+        for (const char* state : { "N", "D" }) {
+            follow(appearance->GetDictionary().GetKey(PdfName(state)));
+        }
+    }
+    return touched;
+}
+
+// Groups of fields that share no objects (by touchedObjects()), each in document order. Fields
+// in different shards can be normalized at the same time without seeing each other's edits.
+vector<vector<size_t>> fieldShards(PdfMemDocument& document, const vector<TerminalField>& terminals) {
+    vector<size_t> parent(terminals.size());
+    for (size_t i = 0; i < terminals.size(); i++) {
+        parent[i] = i;
+    }
+    auto root = [&parent](size_t i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+
+    // Union-find over the fields, joined whenever two of them touch the same object number
+    const size_t unowned = terminals.size();
+    vector<size_t> owner;
+    for (size_t i = 0; i < terminals.size(); i++) {
+        for (uint32_t number : touchedObjects(document.GetObjects(), terminals[i])) {
+            if (number >= owner.size()) {
+                owner.resize(max<size_t>(number + 1, owner.size() * 2), unowned);
+            }
+            if (owner[number] == unowned) {
+                owner[number] = i;
+            } else {
+                parent[root(i)] = root(owner[number]);
+            }
+        }
+    }
+
+    vector<vector<size_t>> shards;
+    vector<size_t> shardOf(terminals.size(), unowned);
+    for (size_t i = 0; i < terminals.size(); i++) {
+        size_t& shard = shardOf[root(i)];
+        if (shard == unowned) {
+            shard = shards.size();
+            shards.emplace_back();
+        }
+        shards[shard].push_back(i);
+    }
+    return shards;
+}
+
+void applyTemplates(PdfMemDocument& document, const vector<vector<TemplateInstall>>& installs,
+                    const string& templateDirectory) {
+    for (const auto& fieldInstalls : installs) {
+        checkBudget("appearance templates");
+        for (const TemplateInstall& install : fieldInstalls) {
+            installTemplate(document, install.appearance, templatePath(templateDirectory, install.filename));
+        }
+    }
+}
+
+// Field manifest (--manifest), one JSON object per terminal field in document order:
+//   {"name":"owner.city","type":"text","flags":0,"widgets":[{"page":0,"rect":[40,700,85,712]}]}
+// Check box and radio button widgets also get the name of their on state ("state":"Yes").
+
+const char* fieldTypeName(PdfFieldType type) {
+    switch (type) {
+        case PdfFieldType::TextBox:
+            return "text";
+        case PdfFieldType::CheckBox:
+            return "checkbox";
+        case PdfFieldType::RadioButton:
+            return "radio";
+        case PdfFieldType::PushButton:
+            return "pushbutton";
+        case PdfFieldType::ComboBox:
+            return "combobox";
+        case PdfFieldType::ListBox:
+            return "listbox";
+        case PdfFieldType::Signature:
+            return "signature";
+        default:
+            return "unknown";
+    }
+}
+
+void writeJsonString(ostream& output, const string& value) {
+    output << '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            output << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[7];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+            output << escaped;
+        } else {
+            output << c;
+        }
+    }
+    output << '"';
+}
+
+void writeJsonNumber(ostream& output, double value) {
+    char number[32];
+    snprintf(number, sizeof(number), "%.10g", value);
+    output << number;
+}
+
+// Page index of every annotation in a page's /Annots, and of the page objects themselves for
+// widgets that are only tied to their page by /P
+struct PageIndex {
+    unordered_map<uint64_t, int> annotations;
+    unordered_map<uint64_t, int> pages;
+};
+
+PageIndex indexPages(PdfMemDocument& document) {
+    PageIndex index;
+    PdfPageCollection& pages = document.GetPages();
+    for (unsigned i = 0; i < pages.GetCount(); i++) {
+        checkBudget("field manifest");
+        PdfPage& page = pages.GetPageAt(i);
+        index.pages.emplace(referenceKey(page.GetObject().GetIndirectReference()), i);
+        const PdfObject* annots = page.GetDictionary().FindKey(PdfName("Annots"));
+        if (!annots || !annots->IsArray()) {
+            continue;
+        }
+        for (const PdfObject& item : annots->GetArray()) {
+            if (item.IsReference()) {
+                index.annotations.emplace(referenceKey(item.GetReference()), i);
+            }
+        }
+    }
+    return index;
+}
+
+int pageOf(const PageIndex& index, const PdfObject& widget) {
+    auto annotation = index.annotations.find(referenceKey(widget.GetIndirectReference()));
+    if (annotation != index.annotations.end()) {
+        return annotation->second;
+    }
+    const PdfObject* page = widget.GetDictionary().GetKey(PdfName("P"));
+    if (page && page->IsReference()) {
+        auto found = index.pages.find(referenceKey(page->GetReference()));
+        if (found != index.pages.end()) {
+            return found->second;
+        }
+    }
+    return -1;
+}
+
+// The normal appearance that isn't /Off, which is what the button is set to when chosen
+string onState(const PdfDictionary& widget) {
+    const PdfObject* appearance = widget.FindKey(PdfName("AP"));
+    if (!appearance || !appearance->IsDictionary()) {
+        return string();
+    }
+    const PdfObject* states = appearance->GetDictionary().FindKey(PdfName("N"));
+    if (!states || !states->IsDictionary()) {
+        return string();
+    }
+    for (const auto& entry : states->GetDictionary()) {
+        if (entry.first.GetString() != "Off") {
+            return string(entry.first.GetString());
+        }
+    }
+    return string();
+}
+
+void writeManifest(PdfMemDocument& document, const vector<TerminalField>& terminals, ostream& manifest) {
+    PageIndex pages = indexPages(document);
+    for (const TerminalField& terminal : terminals) {
+        checkBudget("field manifest");
+        manifest << "{\"name\":";
+        writeJsonString(manifest, terminal.name);
+        manifest << ",\"type\":\"" << fieldTypeName(terminal.type) << "\",\"flags\":" << terminal.flags
+                 << ",\"widgets\":[";
+        for (size_t i = 0; i < terminal.widgets.size(); i++) {
+            const PdfObject& widget = *terminal.widgets[i];
+            int page = pageOf(pages, widget);
+            manifest << (i > 0 ? ",{\"page\":" : "{\"page\":");
+            if (page < 0) {
+                manifest << "null";
+            } else {
+                manifest << page;
+            }
+
+            const PdfObject* rect = widget.GetDictionary().FindKey(PdfName("Rect"));
+            if (rect && rect->IsArray()) {
+                manifest << ",\"rect\":[";
+                bool first = true;
+                for (const PdfObject& value : rect->GetArray()) {
+                    if (value.IsNumberOrReal()) {
+                        manifest << (first ? "" : ",");
+                        writeJsonNumber(manifest, value.GetReal());
+                        first = false;
+                    }
+                }
+                manifest << "]";
+            }
+
+            if (terminal.type == PdfFieldType::CheckBox || terminal.type == PdfFieldType::RadioButton) {
+                string state = onState(widget.GetDictionary());
+                if (!state.empty()) {
+                    manifest << ",\"state\":";
+                    writeJsonString(manifest, state);
+                }
+            }
+            manifest << "}";
+        }
+        manifest << "]}\n";
+    }
+}
+
+// Field values (--values), what the fields updateAcroform() clears held before: the text of a
+// text box, the state of a check box and the option chosen in a radio group. One record per such
+// field in document order, {"name":"owner.city","type":"text","value":"Ghent"} as NDJSON or
+// name,type,value as CSV, with null (an empty CSV value) for a field that had none.
+
+// A button's /V, or without one the state of a widget that is on, which some producers set alone
+bool fieldValue(const TerminalField& terminal, string& value) {
+    const PdfObject* current = terminal.field->GetDictionary().FindKey(PdfName("V"));
+    if (terminal.type == PdfFieldType::TextBox) {
+        if (current && current->IsString()) {
+            value = current->GetString().GetString();
+            return true;
+        }
+        return false;
+    }
+    if (current && current->IsName()) {
+        value = string(current->GetName().GetString());
+        return true;
+    }
+    for (const PdfObject* widget : terminal.widgets) {
+        const PdfObject* state = widget->GetDictionary().GetKey(PdfName("AS"));
+        if (state && state->IsName() && state->GetName().GetString() != "Off") {
+            value = string(state->GetName().GetString());
+            return true;
+        }
+    }
+    return false;
+}
+
+void writeCsvField(ostream& output, const string& value) {
+    if (value.find_first_of(",\"\r\n") == string::npos) {
+        output << value;
+        return;
+    }
+    output << '"';
+    for (char c : value) {
+        output << (c == '"' ? "\"\"" : string(1, c));
+    }
+    output << '"';
+}
+
+void writeValues(const vector<TerminalField>& terminals, ValuesFormat format, ostream& values) {
+    string value;
+    for (const TerminalField& terminal : terminals) {
+        if (terminal.type != PdfFieldType::TextBox && terminal.type != PdfFieldType::CheckBox &&
+            terminal.type != PdfFieldType::RadioButton) {
+            continue;
+        }
+        bool hasValue = fieldValue(terminal, value);
+        if (format == ValuesFormat::Csv) {
+            writeCsvField(values, terminal.name);
+            values << ',' << fieldTypeName(terminal.type) << ',';
+            writeCsvField(values, hasValue ? value : string());
+            values << "\r\n";
+            continue;
+        }
+        values << "{\"name\":";
+        writeJsonString(values, terminal.name);
+        values << ",\"type\":\"" << fieldTypeName(terminal.type) << "\",\"value\":";
+        if (hasValue) {
+            writeJsonString(values, value);
+        } else {
+            values << "null";
+        }
+        values << "}\n";
+    }
+}
+
+void updateAcroform(PdfMemDocument& document, unsigned threads, const string& templateDirectory,
+                    const FieldExports& exports, ValuesFormat valuesFormat) {
+    // Method to update the Default Appearance of the fields in the PDF Acroform Field Dictionary
+
+    // check if the acroform exists
+    PdfAcroForm* acroform = document.GetAcroForm();
+    if(!acroform) {
+        diagnostics() << "No AcroForm found in this document." << endl;
+        return;
+    }
+
+    // See if any fields exist in the document
+    PdfObject* fields = acroform->GetDictionary().FindKey(PdfName("Fields"));
+    if (!fields || !fields->IsArray()) {
+        diagnostics() << "No Fields found in this document" << endl;
+        return;
+    }
+
+    // Drill down into fields, all the way to the terminal ones
+    vector<TerminalField> terminals = collectFields(document, fields->GetArray());
+    vector<vector<TemplateInstall>> installs(terminals.size());
+
+    // From the fields as found: normalizing leaves names, flags, rects and appearance states
+    // alone, and the values are about to go
+    if (exports.manifest) {
+        writeManifest(document, terminals, *exports.manifest);
+    }
+    if (exports.values) {
+        writeValues(terminals, valuesFormat, *exports.values);
+    }
+
+    if (threads <= 1 || terminals.size() < parallelFieldThreshold) {
+        for (size_t i = 0; i < terminals.size(); i++) {
+            normalizeField(terminals[i], installs[i]);
+        }
+    } else {
+        // Large forms: shards of fields that share no objects are normalized concurrently,
+        // which gives the same result as going through the fields in order
+        vector<vector<size_t>> shards = fieldShards(document, terminals);
+        checkBudget("field sharding");
+        parallelFor(shards.size(), threads, [&](size_t shard) {
+            for (size_t i : shards[shard]) {
+                normalizeField(terminals[i], installs[i]);
+            }
+        });
+    }
+
+    // The one step that may touch objects shared between fields
+    applyTemplates(document, installs, templateDirectory);
+}
+
+struct DedupeStats {
+    size_t streams = 0;
+    size_t groups = 0;
+    size_t removed = 0;
+    size_t bytesSaved = 0;
+};
+
+string streamKey(PdfObject& object) {
+    // Two streams with the same dictionary and raw (still filtered) data are interchangeable
+    string key = object.GetDictionary().ToString();
+    key.push_back('\0');
+    charbuff data = object.GetStream()->GetCopy(true);
+    chargeDecodedBytes(data.size(), "stream dedupe");
+    key.append(data.data(), data.size());
+    return key;
+}
+
+size_t dedupeStreamsPass(PdfMemDocument& document, DedupeStats& stats) {
+    struct Candidate {
+        PdfObject* object;
+        string key;     // Only filled once another stream hashes the same
+    };
+
+    PdfIndirectObjectList& objects = document.GetObjects();
+    unordered_map<uint64_t, vector<Candidate>> candidates;
+    unordered_map<uint64_t, PdfReference> replacements;
+    unordered_set<uint64_t> groups;
+    vector<PdfReference> duplicates;
+
+    for (PdfObject* object : objects) {
+        checkBudget("stream dedupe");
+        if (!object->IsDictionary() || !object->HasStream()) {
+            continue;
+        }
+        // Cross reference and object streams are rebuilt by the writer
+        const PdfObject* type = object->GetDictionary().GetKey(PdfName("Type"));
+        if (type && type->IsName() && (type->GetName() == "XRef" || type->GetName() == "ObjStm")) {
+            continue;
+        }
+
+        string key = streamKey(*object);
+        vector<Candidate>& bucket = candidates[hashBytes(key)];
+        Candidate* original = nullptr;
+        for (Candidate& candidate : bucket) {
+            if (candidate.key.empty()) {
+                candidate.key = streamKey(*candidate.object);
+            }
+            if (candidate.key == key) {
+                original = &candidate;
+                break;
+            }
+        }
+
+        if (!original) {
+            bucket.push_back({ object, string() });
+            continue;
+        }
+        const PdfReference& kept = original->object->GetIndirectReference();
+        replacements.emplace(referenceKey(object->GetIndirectReference()), kept);
+        duplicates.push_back(object->GetIndirectReference());
+        groups.insert(referenceKey(kept));
+        stats.bytesSaved += key.size();
+    }
+
+    if (duplicates.empty()) {
+        return 0;
+    }
+
+    // Point every reference at the kept copy, then drop the copies nobody uses anymore
+    auto rewrite = [&replacements](PdfObject& reference) {
+        auto replacement = replacements.find(referenceKey(reference.GetReference()));
+        if (replacement != replacements.end()) {
+            reference = PdfObject(replacement->second);
+        }
+    };
+    for (PdfObject* object : objects) {
+        forEachReference(*object, rewrite);
+    }
+    // The trailer is a PdfDictionaryElement, its dictionary lives in an object of its own
+    forEachReference(document.GetTrailer().GetObject(), rewrite);
+
+    for (const PdfReference& duplicate : duplicates) {
+        objects.RemoveObject(duplicate);
+    }
+    stats.removed += duplicates.size();
+    stats.groups += groups.size();
+    return duplicates.size();
+}
+
+DedupeStats dedupeStreams(PdfMemDocument& document) {
+    // Merging streams can make the dictionaries of streams that reference them identical
+    // (form XObjects sharing an image, for example), so repeat until nothing merges
+    const int maxPasses = 4;
+    DedupeStats stats;
+    for (int pass = 0; pass < maxPasses; pass++) {
+        if (dedupeStreamsPass(document, stats) == 0) {
+            break;
+        }
+    }
+
+    for (PdfObject* object : document.GetObjects()) {
+        if (object->HasStream()) {
+            stats.streams++;
+        }
+    }
+    progress() << "Stream dedupe: removed " << stats.removed << " duplicate streams in " << stats.groups
+         << " groups, " << stats.bytesSaved << " bytes saved (" << stats.streams << " streams kept)" << endl;
+    return stats;
+}
+
+void compactObjects(PdfMemDocument& document) {
+    // Drop every object that can't be reached from the trailer (appearance streams and
+    // action dictionaries we unlinked, old object and cross reference streams, ...)
+    // and renumber the live ones densely so the xref table only lists live objects
+    PdfIndirectObjectList& objects = document.GetObjects();
+
+    uint32_t maxObjectNumber = 0;
+    for (PdfObject* object : objects) {
+        maxObjectNumber = max(maxObjectNumber, object->GetIndirectReference().ObjectNumber());
+    }
+
+    vector<bool> reachable(static_cast<size_t>(maxObjectNumber) + 1, false);
+    vector<PdfObject*> pending;
+    auto mark = [&](PdfObject& reference) {
+        uint32_t number = reference.GetReference().ObjectNumber();
+        if (number > maxObjectNumber || reachable[number]) {
+            return;
+        }
+        PdfObject* target = objects.GetObject(reference.GetReference());
+        if (target) {
+            reachable[number] = true;
+            pending.push_back(target);
+        }
+    };
+
+    PdfObject& trailer = document.GetTrailer().GetObject();
+    forEachReference(trailer, mark);
+    while (!pending.empty()) {
+        checkBudget("compaction");
+        PdfObject* object = pending.back();
+        pending.pop_back();
+        forEachReference(*object, mark);
+    }
+
+    vector<PdfReference> unreachable;
+    for (PdfObject* object : objects) {
+        if (!reachable[object->GetIndirectReference().ObjectNumber()]) {
+            unreachable.push_back(object->GetIndirectReference());
+        }
+    }
+    for (const PdfReference& reference : unreachable) {
+        objects.RemoveObject(reference);
+    }
+
+    objects.RenumberObjects(trailer);
+    progress() << "Compaction: removed " << unreachable.size() << " unreachable objects, "
+         << objects.GetSize() << " objects kept" << endl;
+}
+
+// Elapsed time per stage on stderr (--timings), for comparing runs on the same input
+class StageTimer {
+public:
+    explicit StageTimer(bool enabled) : m_enabled(enabled), m_last(chrono::steady_clock::now()) {}
+
+    void stage(const char* name) {
+        if (!m_enabled) {
+            return;
+        }
+        auto now = chrono::steady_clock::now();
+        std::cerr << "Timing: " << name << " " << chrono::duration<double, milli>(now - m_last).count() << " ms" << std::endl;
+        m_last = now;
+    }
+
+private:
+    bool m_enabled;
+    chrono::steady_clock::time_point m_last;
+};
+
+void passThrough(const string& inputFileName, const string& outputFileName) {
+    // Hard link the input to the output when both are on the same file system, copy otherwise
+    std::error_code error;
+    if (filesystem::equivalent(inputFileName, outputFileName, error)) {
+        return;
+    }
+    filesystem::remove(outputFileName, error);
+    filesystem::create_hard_link(inputFileName, outputFileName, error);
+    if (error) {
+        filesystem::copy_file(inputFileName, outputFileName, filesystem::copy_options::overwrite_existing);
+    }
+}
+
+// Preflight on the raw input: our own sealed outputs go through untouched and documents
+// without forms or active content only get their /Info replaced. True when one of those wrote
+// the output.
+template <typename PassThrough, typename WriteInfoUpdate>
+bool preflightShortcut(const char* data, size_t size, const string& marker, const NormalizeOptions& options,
+                       StageTimer& timer, PassThrough passThrough, WriteInfoUpdate writeInfoUpdate) {
+    PreflightResult preflight = preflightScan(data, size);
+    timer.stage("preflight");
+
+    // Same version and settings, and the seal matches every byte, so this is one of our outputs
+    // as written, forms and all. The exports need the fields read though.
+    bool exports = !options.manifestFile.empty() || !options.valuesFile.empty();
+    if (!exports && sealedOutput(data, size, marker, options.markerKey)) {
+        passThrough();
+        progress() << "Already normalized (" << marker << "), input passed through" << endl;
+        return true;
+    }
+
+    // A raw byte scan can tell this before PoDoFo parses anything
+    if (!options.dedupeStreams && !preflight.needsFullNormalize() && writeInfoUpdate()) {
+        timer.stage("metadata update");
+        progress() << "Preflight: " << preflight.describe() << ", metadata only update written" << endl;
+        return true;
+    }
+    progress() << "Preflight: " << preflight.describe() << endl;
+    return false;
+}
+
+// The export files of one document, opened before anything else so a document without a form
+// still leaves empty ones (a CSV just its header)
+class ExportFiles {
+public:
+    explicit ExportFiles(const NormalizeOptions& options)
+        : m_manifest(open(options.manifestFile, "manifest")), m_values(open(options.valuesFile, "values")) {
+        if (m_values && options.valuesFormat == ValuesFormat::Csv) {
+            *m_values << "name,type,value\r\n";
+        }
+    }
+
+    FieldExports streams() const {
+        return { m_manifest.get(), m_values.get() };
+    }
+
+    void close() {
+        if (m_manifest && !m_manifest->flush()) {
+            throw runtime_error("cannot write the manifest");
+        }
+        if (m_values && !m_values->flush()) {
+            throw runtime_error("cannot write the values");
+        }
+    }
+
+private:
+    static unique_ptr<ofstream> open(const string& filename, const char* what) {
+        if (filename.empty()) {
+            return nullptr;
+        }
+        auto file = make_unique<ofstream>(filename, std::ios::binary | std::ios::trunc);
+        if (!*file) {
+            throw runtime_error(string("cannot open the ") + what + " " + filename);
+        }
+        return file;
+    }
+
+    unique_ptr<ofstream> m_manifest;
+    unique_ptr<ofstream> m_values;
+};
+
+void loadRepaired(PdfMemDocument& document, const char* data, size_t size, unsigned threads, string& repaired) {
+    XrefRepairStats stats;
+    repaired = repairXref(data, size, workerCount(threads), stats);
+    if (repaired.empty()) {
+        throw runtime_error("xref repair found no document catalog");
+    }
+    progress() << "Xref repair: " << stats.objects << " objects, " << stats.compressedObjects
+         << " in object streams, " << stats.milliseconds << " ms" << endl;
+    document.LoadFromBuffer(bufferview(repaired.data(), repaired.size()));
+}
+
+// What the pipeline throws turned into the command line exit status
+template <typename Run>
+int runWithStatus(const NormalizeOptions& options, string& message, Run run) {
+    VerboseScope verbose(options.verbose);
+    try {
+        run();
+        return 0;
+    } catch (const BudgetExceeded& e) {
+        message = e.what();
+        diagnostics() << message << endl;
+        return exitBudgetExceeded;
+    } catch (const std::bad_alloc&) {
+        message = options.limits.heapBytes > 0 ? "Budget exceeded: heap (allocation failed)" : "Exception: out of memory";
+        diagnostics() << message << endl;
+        return options.limits.heapBytes > 0 ? exitBudgetExceeded : 2;
+    } catch (const PdfError& e) {
+        message = string("Error: ") + e.what();
+        diagnostics() << message << endl;
+        return 2;
+    } catch (const std::exception& e) {
+        message = string("Exception: ") + e.what();
+        diagnostics() << message << endl;
+        return 2;
+    }
+}
+
+} // namespace
+
+string normalizedMarker(const NormalizeOptions& options) {
+    // Only the settings that change the output go into the hash
+    string settings = string("dedupeStreams=") + (options.dedupeStreams ? "1" : "0");
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(hashBytes(settings)));
+    return string(normalizerVersion) + " " + hash;
+}
+
+bool parseNormalizeOption(const string& name, const string& value, NormalizeOptions& options) {
+    // Flags take no value, or 1/0 to switch them on and off
+    auto flag = [&value]() {
+        if (value.empty() || value == "1") {
+            return true;
+        }
+        if (value == "0") {
+            return false;
+        }
+        throw invalid_argument(value);
+    };
+    if (name == "dedupe-streams") {
+        options.dedupeStreams = flag();
+    } else if (name == "no-preflight") {
+        options.preflight = !flag();
+    } else if (name == "timings") {
+        options.timings = flag();
+    } else if (name == "verbose") {
+        options.verbose = flag();
+    } else if (name == "quiet") {
+        options.verbose = !flag();
+    } else if (name == "threads") {
+        options.threads = static_cast<unsigned>(stoul(value));
+    } else if (name == "templates") {
+        options.templateDirectory = value;
+    } else if (name == "manifest") {
+        options.manifestFile = value;
+    } else if (name == "values") {
+        options.valuesFile = value;
+    } else if (name == "marker-key") {
+        if (!validSealKey(value)) {
+            throw invalid_argument(value);
+        }
+        options.markerKey = value;
+    } else if (name == "values-format") {
+        if (value == "ndjson") {
+            options.valuesFormat = ValuesFormat::Ndjson;
+        } else if (value == "csv") {
+            options.valuesFormat = ValuesFormat::Csv;
+        } else {
+            throw invalid_argument(value);
+        }
+    } else if (name == "repair") {
+        if (value == "auto") {
+            options.repair = RepairMode::Auto;
+        } else if (value == "always") {
+            options.repair = RepairMode::Always;
+        } else if (value == "never") {
+            options.repair = RepairMode::Never;
+        } else {
+            throw invalid_argument(value);
+        }
+    } else if (name == "max-wall-seconds") {
+        options.limits.wallSeconds = stod(value);
+    } else if (name == "max-cpu-seconds") {
+        options.limits.cpuSeconds = stod(value);
+    } else if (name == "max-decoded-bytes") {
+        options.limits.decodedBytes = stoull(value);
+    } else if (name == "max-heap-bytes") {
+        options.limits.heapBytes = stoull(value);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void preloadTemplates(const string& templateDirectory) {
+    for (const char* filename : templateFiles) {
+        getTemplate(templatePath(templateDirectory, filename));
+    }
+}
+
+string outputTag(const char* data, size_t size) {
+    char tag[21];
+    snprintf(tag, sizeof(tag), "\"%016llx\"", static_cast<unsigned long long>(hashBytes(data, size)));
+    return tag;
+}
+
+string documentTitle(const string& filename) {
+    size_t pos = filename.find_last_of(("/\\"));
+    return (pos == string::npos) ? filename : filename.substr(pos + 1);
+}
+
+void loadDocument(PdfMemDocument& document, const string& filename, RepairMode mode, unsigned threads,
+                  string& repaired) {
+    if (decodedBytesLimited()) {
+        MappedFile input(filename);
+        chargeObjectStreams(input.data(), input.size(), workerCount(threads));
+    }
+    if (mode != RepairMode::Always) {
+        try {
+            document.Load(filename);
+            return;
+        } catch (const PdfError& e) {
+            if (mode == RepairMode::Never) {
+                throw;
+            }
+            progress() << "Load failed (" << e.what() << "), rebuilding the xref table" << endl;
+        }
+    }
+
+    MappedFile input(filename);
+    loadRepaired(document, input.data(), input.size(), threads, repaired);
+}
+
+void loadDocument(PdfMemDocument& document, const char* data, size_t size, RepairMode mode, unsigned threads,
+                  string& repaired) {
+    chargeObjectStreams(data, size, workerCount(threads));
+    if (mode != RepairMode::Always) {
+        try {
+            document.LoadFromBuffer(bufferview(data, size));
+            return;
+        } catch (const PdfError& e) {
+            if (mode == RepairMode::Never) {
+                throw;
+            }
+            progress() << "Load failed (" << e.what() << "), rebuilding the xref table" << endl;
+        }
+    }
+    loadRepaired(document, data, size, threads, repaired);
+}
+
+void normalizeDocument(PdfMemDocument& document, const string& filename, const string& marker,
+                       const NormalizeOptions& options, const FieldExports& exports) {
+    updateAcroform(document, workerCount(options.threads), options.templateDirectory, exports, options.valuesFormat);
+    removeJavaScript(document);
+    clearMetadata(document, filename);
+    stampMarker(document, marker);
+    if (options.dedupeStreams) {
+        dedupeStreams(document);
+    }
+    compactObjects(document);
+    checkBudget("normalize");
+}
+
+DocumentAnalysis analyzeDocument(PdfMemDocument& document) {
+    DocumentAnalysis analysis;
+    analysis.parsed = true;
+    PdfAcroForm* acroform = document.GetAcroForm();
+    PdfObject* fields = acroform ? acroform->GetDictionary().FindKey(PdfName("Fields")) : nullptr;
+    if (fields && fields->IsArray()) {
+        for (const TerminalField& terminal : collectFields(document, fields->GetArray())) {
+            checkBudget("field analysis");
+            countFieldChanges(terminal, analysis);
+        }
+    }
+
+    ActiveContentStats active = sweepActiveContent(document, false);
+    analysis.actions = active.actions;
+    for (const auto& action : active.actions) {
+        analysis.activeActions += action.second;
+    }
+    analysis.actionTriggers = active.triggers + (active.openAction ? 1 : 0);
+    checkBudget("analysis");
+    return analysis;
+}
+
+DocumentAnalysis analyzeBuffer(const char* data, size_t size, const NormalizeOptions& options) {
+    DocumentBudget budget(options.limits);
+    VerboseScope verbose(options.verbose);
+
+    // Without forms or active content the rules have nothing to count, no need to parse at all
+    if (options.preflight && !preflightScan(data, size).needsFullNormalize()) {
+        return DocumentAnalysis();
+    }
+
+    string repaired;
+    PdfMemDocument document;
+    loadDocument(document, data, size, options.repair, options.threads, repaired);
+    checkBudget("load");
+    return analyzeDocument(document);
+}
+
+DocumentAnalysis analyzeFile(const string& inputFileName, const NormalizeOptions& options) {
+    MappedFile input(inputFileName);
+    return analyzeBuffer(input.data(), input.size(), options);
+}
+
+void normalizeFile(const string& inputFileName, const string& outputFileName, const NormalizeOptions& options) {
+    DocumentBudget budget(options.limits);
+    VerboseScope verbose(options.verbose);
+    StageTimer timer(options.timings);
+
+    string marker = normalizedMarker(options);
+    ExportFiles exports(options);
+    if (options.preflight) {
+        MappedFile input(inputFileName);
+        bool written = preflightShortcut(input.data(), input.size(), marker, options, timer,
+            [&] { passThrough(inputFileName, outputFileName); },
+            [&] {
+                return writeInfoUpdate(input, outputFileName, documentTitle(inputFileName), marker, options.markerKey);
+            });
+        if (written) {
+            exports.close();
+            return;
+        }
+    }
+
+    string repaired;
+    PdfMemDocument doc;
+    loadDocument(doc, inputFileName, options.repair, options.threads, repaired);
+    checkBudget("load");
+    timer.stage("load");
+    normalizeDocument(doc, inputFileName, marker, options, exports.streams());
+    timer.stage("normalize");
+    doc.Save(outputFileName);
+    sealOutput(outputFileName, marker, options.markerKey);
+    checkBudget("save");
+    timer.stage("save");
+    exports.close();
+}
+
+void normalizeBuffer(const char* data, size_t size, const string& title, ostream& output,
+                     const NormalizeOptions& options) {
+    DocumentBudget budget(options.limits);
+    VerboseScope verbose(options.verbose);
+    StageTimer timer(options.timings);
+
+    string marker = normalizedMarker(options);
+    ExportFiles exports(options);
+    if (options.preflight) {
+        bool written = preflightShortcut(data, size, marker, options, timer,
+            [&] { output.write(data, size); },
+            [&] { return writeInfoUpdate(data, size, output, title, marker, options.markerKey); });
+        if (written) {
+            if (!output.flush()) {
+                throw runtime_error("cannot write the output");
+            }
+            exports.close();
+            return;
+        }
+    }
+
+    string repaired;
+    PdfMemDocument doc;
+    loadDocument(doc, data, size, options.repair, options.threads, repaired);
+    checkBudget("load");
+    timer.stage("load");
+    normalizeDocument(doc, title, marker, options, exports.streams());
+    timer.stage("normalize");
+    // PdfWriter asks its device for positions, which a pipe can't answer, so it saves to memory
+    string buffer;
+    StringStreamDevice device(buffer);
+    doc.Save(device);
+    sealOutput(buffer, marker, options.markerKey);
+    checkBudget("save");
+    if (!output.write(buffer.data(), buffer.size()).flush()) {
+        throw runtime_error("cannot write the output");
+    }
+    checkBudget("save");
+    timer.stage("save");
+    exports.close();
+}
+
+int normalizeFileStatus(const string& inputFileName, const string& outputFileName, const NormalizeOptions& options,
+                        string& message) {
+    return runWithStatus(options, message, [&] { normalizeFile(inputFileName, outputFileName, options); });
+}
+
+int normalizeBufferStatus(const char* data, size_t size, const string& title, ostream& output,
+                          const NormalizeOptions& options, string& message) {
+    return runWithStatus(options, message, [&] { normalizeBuffer(data, size, title, output, options); });
+}
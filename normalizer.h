@@ -0,0 +1,133 @@
+#ifndef NORMALIZER_H
+#define NORMALIZER_H
+
+#include <podofo/podofo.h>
+#include "budget.h"
+
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <string>
+
+// When to rebuild the cross reference table: only after PoDoFo fails to load the file, before
+// every load, or never
+enum class RepairMode { Auto, Always, Never };
+
+// How the field values captured before normalizing are written: a JSON object per line, or CSV
+enum class ValuesFormat { Ndjson, Csv };
+
+// Settings that change what the normalizer writes, filled in from the command line
+struct NormalizeOptions {
+    bool dedupeStreams = false;
+    bool preflight = true;
+    RepairMode repair = RepairMode::Auto;
+    bool timings = false;
+    bool verbose = false;       // Progress messages on stdout and errors on stderr, off for the library
+    unsigned threads = 0;       // Threads for field sharding and the xref repair scan, 0 for one per hardware thread
+    std::string templateDirectory;  // Where the *_AP_*.txt appearance templates are, empty for the working directory
+    std::string manifestFile;       // Where to write the form's field manifest (JSON Lines), empty for none
+    std::string valuesFile;         // Where to write the field values from before they were cleared, empty for none
+    ValuesFormat valuesFormat = ValuesFormat::Ndjson;
+    std::string markerKey;          // Key of the seal on outputs (32 hex digits), empty for the built-in one
+    BudgetLimits limits;
+};
+
+// Concurrency: everything here can run on several threads at once as long as each thread works
+// on its own PdfMemDocument. The only state shared between documents is the appearance template
+// cache, which is locked, and budgets (budget.h) follow the thread that created them and the
+// workers of its parallel stages. A single document must not be used from two calls at the
+// same time.
+
+// Set one option by its command line name, without the dashes ("repair", "max-wall-seconds").
+// Flags ("dedupe-streams") take an empty value, "1" or "0". False for an unknown name, throws
+// std::logic_error for a value that doesn't parse.
+bool parseNormalizeOption(const std::string& name, const std::string& value, NormalizeOptions& options);
+
+// Read and deflate every appearance template now rather than on the first form that needs it.
+// Throws when one is missing.
+void preloadTemplates(const std::string& templateDirectory);
+
+// Marker stamped on outputs, "<version> <hash of the settings that change the output>", sealed
+// with options.markerKey when the output is written
+std::string normalizedMarker(const NormalizeOptions& options);
+
+// Entity tag of a normalized output, a hash of its bytes quoted for an ETag header
+std::string outputTag(const char* data, size_t size);
+
+// Title the normalized document gets, the file name without its directory
+std::string documentTitle(const std::string& filename);
+
+// Load the input, rebuilding its xref table from the raw bytes when the mode asks for it or
+// PoDoFo can't make sense of the one in the file. Only that rebuild runs on threads threads,
+// PoDoFo parses the objects of an intact file (or a repaired one) on the calling thread. PoDoFo
+// reads streams lazily from the buffer, so repaired has to outlive the document.
+void loadDocument(PoDoFo::PdfMemDocument& document, const std::string& filename, RepairMode mode,
+                  unsigned threads, std::string& repaired);
+
+// Same, for a document already in memory. data has to outlive the document too.
+void loadDocument(PoDoFo::PdfMemDocument& document, const char* data, size_t size, RepairMode mode,
+                  unsigned threads, std::string& repaired);
+
+// Where the field walk writes what it found on its way, each null for nothing:
+//  - manifest gets a JSON object per terminal field with its fully qualified name, type, flags,
+//    and the page, rect and on state of each widget
+//  - values gets the value of each text box, check box and radio group from before they were
+//    cleared, in options.valuesFormat
+struct FieldExports {
+    std::ostream* manifest = nullptr;
+    std::ostream* values = nullptr;
+};
+
+// Normalize a loaded document in place: form fields, active content, metadata (titled after
+// filename), the marker, then optional stream dedupe and the compaction of unreachable objects
+void normalizeDocument(PoDoFo::PdfMemDocument& document, const std::string& filename,
+                       const std::string& marker, const NormalizeOptions& options,
+                       const FieldExports& exports = {});
+
+// What normalizeDocument() would find and change in a document (--analyze)
+struct DocumentAnalysis {
+    bool parsed = false;            // False when the preflight scan showed there was nothing to count
+    size_t fields = 0;              // Terminal fields, by type below
+    size_t textBoxes = 0;
+    size_t checkBoxes = 0;
+    size_t radioGroups = 0;
+    size_t otherFields = 0;
+    size_t widgets = 0;
+    size_t valuesCleared = 0;       // Fields that have a value to clear
+    size_t statesReset = 0;         // Button widgets that are on and would be turned off
+    size_t appearanceStreams = 0;   // Appearance streams replaced with a template or dropped
+    size_t fieldEdits = 0;          // Every entry the field normalizers would set or remove
+    size_t activeActions = 0;       // Active actions that would be emptied, by type in actions
+    std::map<std::string, size_t> actions;
+    size_t actionTriggers = 0;      // /OpenAction, /AA, /JavaScript, /XFA and /A entries that would go
+};
+
+// Walk a loaded document with the same rules as normalizeDocument(), counting instead of changing
+DocumentAnalysis analyzeDocument(PoDoFo::PdfMemDocument& document);
+
+// Analyze a document under a budget of options.limits, loaded only when the preflight scan finds
+// forms or active content, and never saved. Throws like normalizeFile().
+DocumentAnalysis analyzeBuffer(const char* data, size_t size, const NormalizeOptions& options);
+DocumentAnalysis analyzeFile(const std::string& inputFileName, const NormalizeOptions& options);
+
+// The whole pipeline for one file: preflight (pass through for a sealed output of the same
+// settings, metadata only update when that is enough), load, normalize and save to outputFileName, all under a budget of options.limits, with
+// the field manifest and values in options.manifestFile and options.valuesFile when set. Throws BudgetExceeded, PdfError or std::exception.
+void normalizeFile(const std::string& inputFileName, const std::string& outputFileName,
+                   const NormalizeOptions& options);
+
+// The same pipeline for a document in memory, titled title, written to output in order. Nothing
+// touches the file system, so output can be a pipe.
+void normalizeBuffer(const char* data, size_t size, const std::string& title, std::ostream& output,
+                     const NormalizeOptions& options);
+
+// normalizeFile() with what it throws turned into the command line exit status (0 done, 2 error,
+// exitBudgetExceeded). The error goes to stderr and into message.
+int normalizeFileStatus(const std::string& inputFileName, const std::string& outputFileName,
+                        const NormalizeOptions& options, std::string& message);
+
+// normalizeBuffer() with the same exit status
+int normalizeBufferStatus(const char* data, size_t size, const std::string& title, std::ostream& output,
+                          const NormalizeOptions& options, std::string& message);
+
+#endif // NORMALIZER_H
@@ -0,0 +1,212 @@
+#include <podofo/podofo.h>
+#include "normalizer.h"
+#include "parallel.h"
+#include "preflight.h"
+#include "xrefRepair.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+using namespace std;
+
+// Stress test for the normalizer's concurrency, meant to run in a -DSANITIZE_THREAD=ON build
+// (ctest runs it on the sample PDFs and the syntheticForms.py corpus):
+//   normalizerStress [--rounds=N] [--threads=N] [--templates=DIR] <file or directory>...
+// Every document is first normalized alone with one thread, which gives the reference bytes.
+// Then each check normalizes all of them rounds times over, several documents and threads at
+// once, and compares every output byte for byte with its reference. The xref repair scan is
+// checked the same way on each document repeated past the size it splits into byte ranges.
+// Exit status 1 on any difference.
+
+namespace {
+
+// A configuration compared against the sequential run
+struct Check {
+    const char* name;
+    unsigned documents;     // Documents normalized at the same time
+    unsigned threads;       // Threads within one document: field shards and the repair scan
+};
+
+// PdfMemDocument::Save stamps the time of the save into /ModDate and the /ID it derives from
+// /Info, so those are blanked (at the same length, offsets stay put) before comparing
+void maskSaveTime(string& pdf) {
+    for (size_t key = pdf.find("/ModDate"); key != string::npos; key = pdf.find("/ModDate", key + 1)) {
+        size_t open = pdf.find_first_not_of(" \r\n\t", key + 8);
+        size_t close = open == string::npos || pdf[open] != '(' ? string::npos : pdf.find(')', open);
+        if (close != string::npos) {
+            fill(pdf.begin() + open + 1, pdf.begin() + close, '0');
+        }
+    }
+    for (size_t key = pdf.find("/ID"); key != string::npos; key = pdf.find("/ID", key + 1)) {
+        size_t open = pdf.find_first_not_of(" \r\n\t", key + 3);
+        size_t close = open == string::npos || pdf[open] != '[' ? string::npos : pdf.find(']', open);
+        if (close == string::npos) {
+            continue;
+        }
+        for (size_t i = open + 1; i < close; i++) {
+            if (isxdigit(static_cast<unsigned char>(pdf[i]))) {
+                pdf[i] = '0';
+            }
+        }
+    }
+}
+
+// The masked output, or the exit status and message when the document didn't normalize (which
+// must then fail the same way every time)
+string normalized(const MappedFile& input, const string& title, const NormalizeOptions& options) {
+    ostringstream output;
+    string message;
+    int status = normalizeBufferStatus(input.data(), input.size(), title, output, options, message);
+    if (status != 0) {
+        return "status " + to_string(status) + ": " + message;
+    }
+    string pdf = output.str();
+    maskSaveTime(pdf);
+    return pdf;
+}
+
+// The repair scan only splits files of 4 MB and more into ranges, so the input is repeated past
+// four of them; later copies redefine the same objects, like incremental updates do
+string repeated(const MappedFile& input) {
+    string file;
+    file.reserve((16 << 20) + input.size() + 1);
+    while (file.size() < (16 << 20)) {
+        file.append(input.data(), input.size());
+        file += '\n';
+    }
+    return file;
+}
+
+// The repaired file, or what repairXref() threw
+string repairedXref(const string& file, unsigned threads) {
+    try {
+        XrefRepairStats stats;
+        return repairXref(file.data(), file.size(), threads, stats);
+    } catch (const std::exception& e) {
+        return string("throws: ") + e.what();
+    }
+}
+
+vector<string> inputFiles(const vector<string>& paths) {
+    vector<string> files;
+    for (const string& path : paths) {
+        if (!filesystem::is_directory(path)) {
+            files.push_back(path);
+            continue;
+        }
+        for (const auto& entry : filesystem::directory_iterator(path)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".pdf") {
+                files.push_back(entry.path().string());
+            }
+        }
+    }
+    sort(files.begin(), files.end());
+    return files;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    unsigned rounds = 4;
+    unsigned threads = 0;
+    NormalizeOptions base;
+    vector<string> paths;
+    try {
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            string value = arg.substr(arg.find('=') + 1);
+            if (arg.rfind("--rounds=", 0) == 0) {
+                rounds = static_cast<unsigned>(stoul(value));
+            } else if (arg.rfind("--threads=", 0) == 0) {
+                threads = static_cast<unsigned>(stoul(value));
+            } else if (arg.rfind("--templates=", 0) == 0) {
+                base.templateDirectory = value;
+            } else if (arg.rfind("--", 0) == 0) {
+                throw invalid_argument(arg);
+            } else {
+                paths.push_back(arg);
+            }
+        }
+    } catch (const std::logic_error&) {
+        paths.clear();
+    }
+    vector<string> files = inputFiles(paths);
+    if (files.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--rounds=N] [--threads=N] [--templates=DIR] <file or directory>..."
+                  << std::endl;
+        return 1;
+    }
+
+    vector<unique_ptr<MappedFile>> inputs;
+    for (const string& file : files) {
+        inputs.push_back(make_unique<MappedFile>(file));
+    }
+    unsigned workers = max(2u, workerCount(threads));
+
+    // Many documents at once, each on one thread, then a couple at a time, each sharded over
+    // the workers (forms past the sharding threshold)
+    const Check checks[] = {
+        { "concurrent documents", workers, 1 },
+        { "sharded fields", 2, workers },
+    };
+
+    size_t failures = 0;
+    for (const Check& check : checks) {
+        NormalizeOptions sequential = base;
+        sequential.threads = 1;
+        NormalizeOptions tested = sequential;
+        tested.threads = check.threads;
+
+        vector<string> references;
+        for (size_t i = 0; i < files.size(); i++) {
+            references.push_back(normalized(*inputs[i], documentTitle(files[i]), sequential));
+        }
+
+        // Rounds interleaved, so every document runs next to every other one
+        atomic<size_t> differences(0);
+        mutex reportMutex;
+        parallelFor(files.size() * rounds, check.documents, [&](size_t item) {
+            size_t i = item % files.size();
+            if (normalized(*inputs[i], documentTitle(files[i]), tested) != references[i]) {
+                differences++;
+                lock_guard<mutex> lock(reportMutex);
+                std::cerr << check.name << ": " << files[i] << " differs from the sequential run" << std::endl;
+            }
+        });
+
+        cout << check.name << ": " << files.size() << " documents x " << rounds << " rounds, " << check.documents
+             << " at a time on " << check.threads << " threads each, " << differences << " differences" << endl;
+        failures += differences;
+    }
+
+    // The repair scan on its own, sequential against ranges on every worker
+    vector<string> repeatedFiles;
+    vector<string> repairReferences;
+    for (const auto& input : inputs) {
+        repeatedFiles.push_back(repeated(*input));
+        repairReferences.push_back(repairedXref(repeatedFiles.back(), 1));
+    }
+    atomic<size_t> repairDifferences(0);
+    mutex reportMutex;
+    parallelFor(files.size() * rounds, workers, [&](size_t item) {
+        size_t i = item % files.size();
+        if (repairedXref(repeatedFiles[i], workers) != repairReferences[i]) {
+            repairDifferences++;
+            lock_guard<mutex> lock(reportMutex);
+            std::cerr << "repair scan: " << files[i] << " differs from the sequential run" << std::endl;
+        }
+    });
+    cout << "repair scan: " << files.size() << " documents of 16 MB x " << rounds << " rounds, " << workers
+         << " at a time on " << workers << " threads each, " << repairDifferences << " differences" << endl;
+    failures += repairDifferences;
+    return failures == 0 ? 0 : 1;
+}
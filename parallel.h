@@ -0,0 +1,79 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "budget.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker count for a --threads value, 0 means one per hardware thread
+inline unsigned workerCount(unsigned requested) {
+    if (requested > 0) {
+        return requested;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Threads per document when a pool of workers (a --workers value) normalizes documents side by
+// side: the hardware threads shared out between them, at least one each
+inline unsigned documentThreads(unsigned workers) {
+    return std::max(1u, workerCount(0) / workerCount(workers));
+}
+
+// Run body(i) for every i below count on up to threads workers (the calling thread being one
+// of them). Items are handed out one at a time, so uneven items balance out. The first
+// exception thrown by any item is rethrown here once all workers have stopped. Workers count
+// against the calling thread's document budget, their CPU time charged after every item.
+template <typename Body>
+void parallelFor(size_t count, unsigned threads, Body&& body) {
+    unsigned workers = static_cast<unsigned>(std::min<size_t>(std::max(1u, threads), count));
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto work = [&](BudgetShare* share) {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                body(i);
+                if (share) {
+                    share->charge();
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = count;
+            }
+        }
+    };
+
+    DocumentBudget* budget = DocumentBudget::current();
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < workers; i++) {
+        pool.emplace_back([&work, budget] {
+            BudgetShare share(budget);
+            work(&share);
+        });
+    }
+    work(nullptr);
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,141 @@
+#include "pdfnorm.h"
+#include "budget.h"
+#include "normalizer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+using namespace std;
+
+struct pdfnorm_normalizer {
+    NormalizeOptions options;
+};
+
+namespace {
+
+thread_local string lastError;
+
+int fail(int status, const string& message) {
+    lastError = message;
+    return status;
+}
+
+// Output written straight into a malloc'd block that is handed to the caller as it is
+class MallocBuffer : public streambuf {
+public:
+    ~MallocBuffer() { free(m_data); }
+
+    // The block and its size, which the caller now owns
+    char* release(size_t& size) {
+        size = m_size;
+        char* data = m_data;
+        m_data = nullptr;
+        m_size = m_capacity = 0;
+        return data;
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (traits_type::eq_int_type(c, traits_type::eof())) {
+            return traits_type::not_eof(c);
+        }
+        char byte = traits_type::to_char_type(c);
+        return xsputn(&byte, 1) == 1 ? c : traits_type::eof();
+    }
+
+    streamsize xsputn(const char* data, streamsize count) override {
+        size_t size = static_cast<size_t>(count);
+        if (m_size + size > m_capacity) {
+            size_t capacity = max(m_size + size, m_capacity * 2);
+            char* grown = static_cast<char*>(realloc(m_data, max<size_t>(capacity, 1)));
+            if (!grown) {
+                throw bad_alloc();
+            }
+            m_data = grown;
+            m_capacity = capacity;
+        }
+        memcpy(m_data + m_size, data, size);
+        m_size += size;
+        return count;
+    }
+
+private:
+    char* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+};
+
+} // namespace
+
+pdfnorm_normalizer* pdfnorm_create(void) {
+    return new (nothrow) pdfnorm_normalizer();
+}
+
+void pdfnorm_destroy(pdfnorm_normalizer* normalizer) {
+    delete normalizer;
+}
+
+int pdfnorm_set_option(pdfnorm_normalizer* normalizer, const char* name, const char* value) {
+    if (!normalizer || !name) {
+        return fail(PDFNORM_INVALID_ARGUMENT, "No normalizer or option name");
+    }
+    try {
+        if (!parseNormalizeOption(name, value ? value : "", normalizer->options)) {
+            return fail(PDFNORM_INVALID_ARGUMENT, string("Unknown option: ") + name);
+        }
+    } catch (const std::logic_error&) {
+        return fail(PDFNORM_INVALID_ARGUMENT, string("Invalid value for ") + name + ": " + (value ? value : ""));
+    }
+    return PDFNORM_OK;
+}
+
+int pdfnorm_prepare(pdfnorm_normalizer* normalizer) {
+    if (!normalizer) {
+        return fail(PDFNORM_INVALID_ARGUMENT, "No normalizer");
+    }
+    try {
+        preloadTemplates(normalizer->options.templateDirectory);
+    } catch (const std::exception& e) {
+        return fail(PDFNORM_ERROR, e.what());
+    }
+    return PDFNORM_OK;
+}
+
+int pdfnorm_normalize_buffer(pdfnorm_normalizer* normalizer, const void* data, size_t size, const char* title,
+                             void** output, size_t* output_size) {
+    if (!normalizer || (!data && size > 0) || !output || !output_size) {
+        return fail(PDFNORM_INVALID_ARGUMENT, "No normalizer, input or output");
+    }
+    MallocBuffer buffer;
+    ostream stream(&buffer);
+    string message;
+    int status = normalizeBufferStatus(static_cast<const char*>(data), size, title ? title : "", stream,
+                                       normalizer->options, message);
+    if (status != 0) {
+        return fail(status, message);
+    }
+    *output = buffer.release(*output_size);
+    return PDFNORM_OK;
+}
+
+void pdfnorm_free(void* output) {
+    free(output);
+}
+
+int pdfnorm_normalize_file(pdfnorm_normalizer* normalizer, const char* input_path, const char* output_path) {
+    if (!normalizer || !input_path || !output_path) {
+        return fail(PDFNORM_INVALID_ARGUMENT, "No normalizer, input or output");
+    }
+    string message;
+    int status = normalizeFileStatus(input_path, output_path, normalizer->options, message);
+    return status == 0 ? PDFNORM_OK : fail(status, message);
+}
+
+const char* pdfnorm_last_error(void) {
+    return lastError.c_str();
+}
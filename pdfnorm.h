@@ -0,0 +1,64 @@
+#ifndef PDFNORM_H
+#define PDFNORM_H
+
+/* libpdfnorm, the form normalizer behind a C API. Create a normalizer once with its options,
+ * warm it up with pdfnorm_prepare(), then normalize as many buffers or files with it as needed.
+ * A normalizer can be used from several threads at once, each call on its own document. */
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define PDFNORM_API __attribute__((visibility("default")))
+#else
+#define PDFNORM_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Status of every call, the same numbers the command line tool exits with */
+enum {
+    PDFNORM_OK = 0,
+    PDFNORM_INVALID_ARGUMENT = 1,
+    PDFNORM_ERROR = 2,              /* The document couldn't be normalized */
+    PDFNORM_BUDGET_EXCEEDED = 3     /* The document passed one of the max-* limits */
+};
+
+typedef struct pdfnorm_normalizer pdfnorm_normalizer;
+
+/* A normalizer with the default options, NULL when out of memory */
+PDFNORM_API pdfnorm_normalizer* pdfnorm_create(void);
+PDFNORM_API void pdfnorm_destroy(pdfnorm_normalizer* normalizer);
+
+/* Set an option by its command line name without the dashes: "repair" to "always",
+ * "max-wall-seconds" to "60", "templates" to a directory, "marker-key" to the 32 hex digits that
+ * seal outputs so they pass through when fed back in. Flags such as "dedupe-streams" take
+ * NULL, "1" or "0". Options are meant to be set before the normalizer is shared between threads.
+ * The library prints nothing by default; "verbose" (or "quiet" to "0") sends the command line
+ * tool's progress messages to stdout and its errors to stderr, which pdfnorm_last_error() has
+ * either way. */
+PDFNORM_API int pdfnorm_set_option(pdfnorm_normalizer* normalizer, const char* name, const char* value);
+
+/* Load the appearance templates now instead of on the first form that needs them. Optional,
+ * fails when a template is missing from the "templates" directory. */
+PDFNORM_API int pdfnorm_prepare(pdfnorm_normalizer* normalizer);
+
+/* Normalize the PDF in data, titled title. On success *output holds the normalized PDF, to be
+ * released with pdfnorm_free(), and *output_size its size. */
+PDFNORM_API int pdfnorm_normalize_buffer(pdfnorm_normalizer* normalizer, const void* data, size_t size,
+                                         const char* title, void** output, size_t* output_size);
+PDFNORM_API void pdfnorm_free(void* output);
+
+/* Normalize the file at input_path into output_path, titled after the input file name */
+PDFNORM_API int pdfnorm_normalize_file(pdfnorm_normalizer* normalizer, const char* input_path,
+                                       const char* output_path);
+
+/* Message of the last call on this thread that failed, empty when there is none */
+PDFNORM_API const char* pdfnorm_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PDFNORM_H */
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Profile guided, link time optimized release build of the normalizer:
+#   ./pgoBuild.sh [BUILD_DIR] [cmake options...]
+# Builds BUILD_DIR (build-pgo by default) instrumented, trains it on the sample PDFs and the
+# synthetic corpus from syntheticForms.py, then rebuilds the same directory with the profiles.
+# TARGET names the executable (normCPP in the Docker build) and ASSETS the directory with the
+# appearance templates and sample PDFs, the source directory unless they were copied elsewhere.
+set -e
+
+source=$(cd "$(dirname "$0")" && pwd)
+build=${1:-$source/build-pgo}
+[ $# -gt 0 ] && shift
+mkdir -p "$build"
+build=$(cd "$build" && pwd)
+target=${TARGET:-untitled}
+assets=${ASSETS:-$source}
+profiles=$build/pgo-profiles
+corpus=$build/pgo-corpus
+output=$build/pgo-output
+
+configure() {
+    cmake -S "$source" -B "$build" -DCMAKE_BUILD_TYPE=Release -DENABLE_LTO=ON -DPGO_PROFILE_DIR="$profiles" "$@"
+}
+
+rm -rf "$profiles" "$output"
+configure -DPGO=GENERATE "$@"
+cmake --build "$build" -j "$(nproc)"
+
+python3 "$source/syntheticForms.py" "$corpus"
+cp "$assets"/*.pdf "$corpus"/
+mkdir -p "$output"
+
+train() {
+    "$build/$target" --templates="$assets" --output-dir="$output" "$@" > /dev/null 2>&1 ||
+        echo "Training run failed: $*" >&2
+}
+
+# The paths the service takes: plain and with the save options, the xref repair, stdin to
+# stdout, and already normalized documents, which the preflight passes straight through
+for pdf in "$corpus"/*.pdf; do
+    name=$(basename "$pdf")
+    train "$pdf" "$name"
+    train --dedupe-streams --threads=4 "$pdf" "threads-$name"
+    train --repair=always "$pdf" "repaired-$name"
+    train --title="$name" - - < "$pdf"
+    train "$output/$name" "again-$name"
+done
+
+if ls "$profiles"/*.profraw > /dev/null 2>&1; then
+    # Clang leaves raw profiles that have to be merged first
+    llvm-profdata merge -output="$profiles/default.profdata" "$profiles"/*.profraw
+fi
+
+configure -DPGO=USE "$@"
+cmake --build "$build" -j "$(nproc)"
@@ -0,0 +1,708 @@
+#include "preflight.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+MappedFile::MappedFile(const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Cannot open " + filename);
+    }
+
+    struct stat info {};
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+            m_data = static_cast<const char*>(mapped);
+            m_size = info.st_size;
+            m_mapped = true;
+        }
+    }
+    close(fd);
+
+    if (!m_mapped) {
+        ifstream file(filename, std::ios::binary);
+        m_buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (m_mapped) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+}
+
+namespace {
+
+// Names the normalizer acts on and the flag each one sets
+struct NameToken {
+    string_view name;
+    bool PreflightResult::* flag;
+};
+
+const NameToken nameTokens[] = {
+    { "AcroForm", &PreflightResult::acroForm },
+    { "Widget", &PreflightResult::widgets },
+    { "JavaScript", &PreflightResult::javaScript },
+    { "JS", &PreflightResult::javaScript },
+    { "OpenAction", &PreflightResult::openAction },
+    { "AA", &PreflightResult::additionalActions },
+    { "XFA", &PreflightResult::activeActions },
+    { "Launch", &PreflightResult::activeActions },
+    { "SubmitForm", &PreflightResult::activeActions },
+    { "ImportData", &PreflightResult::activeActions },
+    { "GoToR", &PreflightResult::activeActions },
+    { "GoToE", &PreflightResult::activeActions },
+    { "Rendition", &PreflightResult::activeActions },
+    { "RichMediaExecute", &PreflightResult::activeActions },
+    { "Sound", &PreflightResult::activeActions },
+    { "Movie", &PreflightResult::activeActions },
+    { "ObjStm", &PreflightResult::objectStreams },
+    { "Encrypt", &PreflightResult::encrypted },
+};
+
+bool isDelimiter(unsigned char c) {
+    switch (c) {
+        case '\0': case '\t': case '\n': case '\f': case '\r': case ' ':
+        case '(': case ')': case '<': case '>': case '[': case ']':
+        case '{': case '}': case '/': case '%':
+            return true;
+        default:
+            return false;
+    }
+}
+
+const char* findSlash(const char* p, const char* end) {
+#if defined(__SSE2__)
+    // Sixteen bytes per compare, most of a PDF by size is binary stream data without names
+    const __m128i slash = _mm_set1_epi8('/');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, slash));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    while (p < end && *p != '/') {
+        p++;
+    }
+    return p;
+#else
+    const void* found = memchr(p, '/', end - p);
+    return found ? static_cast<const char*>(found) : end;
+#endif
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// #xx escapes can spell any name (/J#61vaScript), decode them before comparing
+string decodeName(string_view name) {
+    string decoded;
+    for (size_t i = 0; i < name.size(); i++) {
+        int high = i + 2 < name.size() ? hexValue(name[i + 1]) : -1;
+        int low = high < 0 ? -1 : hexValue(name[i + 2]);
+        if (name[i] == '#' && low >= 0) {
+            decoded.push_back(static_cast<char>(high * 16 + low));
+            i += 2;
+        } else {
+            decoded.push_back(name[i]);
+        }
+    }
+    return decoded;
+}
+
+void checkName(string_view name, PreflightResult& result) {
+    string decoded = name.find('#') != string_view::npos ? decodeName(name) : string();
+
+    for (const NameToken& token : nameTokens) {
+        if (name == token.name) {
+            result.*token.flag = true;
+            return;
+        }
+        if (!decoded.empty() && decoded == token.name) {
+            result.*token.flag = true;
+            result.escapedNames = true;
+            return;
+        }
+    }
+}
+
+// Whether wanted appears as a name anywhere in text, escaped or not
+bool containsName(string_view text, string_view wanted) {
+    const char* end = text.data() + text.size();
+    const char* p = text.data();
+    while ((p = findSlash(p, end)) != end) {
+        const char* name = ++p;
+        while (p < end && !isDelimiter(*p)) {
+            p++;
+        }
+        if (decodeName(string_view(name, p - name)) == wanted) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void skipWhitespace(string_view file, size_t& pos) {
+    while (pos < file.size() && isspace(static_cast<unsigned char>(file[pos]))) {
+        pos++;
+    }
+}
+
+bool parseNumber(string_view file, size_t& pos, uint64_t& value) {
+    skipWhitespace(file, pos);
+    size_t start = pos;
+    value = 0;
+    while (pos < file.size() && isdigit(static_cast<unsigned char>(file[pos]))) {
+        value = value * 10 + (file[pos] - '0');
+        pos++;
+    }
+    return pos > start;
+}
+
+bool parseReference(string_view file, size_t pos, uint64_t& number, uint64_t& generation) {
+    if (!parseNumber(file, pos, number) || !parseNumber(file, pos, generation)) {
+        return false;
+    }
+    skipWhitespace(file, pos);
+    return pos < file.size() && file[pos] == 'R';
+}
+
+// Offset just past the dictionary starting at pos, skipping over strings and comments
+size_t skipDictionary(string_view file, size_t pos) {
+    int depth = 0;
+    while (pos < file.size()) {
+        char c = file[pos];
+        if (c == '(') {
+            int parens = 0;
+            while (pos < file.size()) {
+                c = file[pos++];
+                if (c == '\\') {
+                    pos++;
+                } else if (c == '(') {
+                    parens++;
+                } else if (c == ')' && --parens == 0) {
+                    break;
+                }
+            }
+        } else if (c == '%') {
+            while (pos < file.size() && file[pos] != '\n' && file[pos] != '\r') {
+                pos++;
+            }
+        } else if (file.compare(pos, 2, "<<") == 0) {
+            depth++;
+            pos += 2;
+        } else if (file.compare(pos, 2, ">>") == 0) {
+            pos += 2;
+            if (--depth == 0) {
+                return pos;
+            }
+        } else if (c == '<') {
+            size_t close = file.find('>', pos);
+            if (close == string_view::npos) {
+                return string_view::npos;
+            }
+            pos = close + 1;
+        } else {
+            pos++;
+        }
+    }
+    return string_view::npos;
+}
+
+size_t countOccurrences(string_view file, string_view token) {
+    size_t count = 0;
+    for (size_t pos = file.find(token); pos != string_view::npos; pos = file.find(token, pos + token.size())) {
+        count++;
+    }
+    return count;
+}
+
+// SipHash-2-4, a keyed 64 bit hash fed in pieces, for the seal on normalized outputs
+class SipHash {
+public:
+    SipHash(uint64_t k0, uint64_t k1)
+        : m_v0(k0 ^ 0x736f6d6570736575ULL), m_v1(k1 ^ 0x646f72616e646f6dULL),
+          m_v2(k0 ^ 0x6c7967656e657261ULL), m_v3(k1 ^ 0x7465646279746573ULL) {}
+
+    void update(const char* data, size_t size) {
+        m_length += size;
+        while (size > 0 && (m_pending > 0 || size < 8)) {
+            m_tail |= static_cast<uint64_t>(static_cast<unsigned char>(*data++)) << (8 * m_pending++);
+            size--;
+            if (m_pending == 8) {
+                compress(m_tail);
+                m_tail = 0;
+                m_pending = 0;
+            }
+        }
+        for (; size >= 8; data += 8, size -= 8) {
+            uint64_t word = 0;
+            for (int i = 7; i >= 0; i--) {
+                word = (word << 8) | static_cast<unsigned char>(data[i]);
+            }
+            compress(word);
+        }
+        for (; size > 0; size--) {
+            m_tail |= static_cast<uint64_t>(static_cast<unsigned char>(*data++)) << (8 * m_pending++);
+        }
+    }
+
+    void update(string_view data) {
+        update(data.data(), data.size());
+    }
+
+    uint64_t finish() {
+        compress(m_tail | (m_length << 56));
+        m_v2 ^= 0xff;
+        for (int i = 0; i < 4; i++) {
+            round();
+        }
+        return m_v0 ^ m_v1 ^ m_v2 ^ m_v3;
+    }
+
+private:
+    static uint64_t rotate(uint64_t x, int bits) {
+        return (x << bits) | (x >> (64 - bits));
+    }
+
+    void round() {
+        m_v0 += m_v1; m_v1 = rotate(m_v1, 13); m_v1 ^= m_v0; m_v0 = rotate(m_v0, 32);
+        m_v2 += m_v3; m_v3 = rotate(m_v3, 16); m_v3 ^= m_v2;
+        m_v0 += m_v3; m_v3 = rotate(m_v3, 21); m_v3 ^= m_v0;
+        m_v2 += m_v1; m_v1 = rotate(m_v1, 17); m_v1 ^= m_v2; m_v2 = rotate(m_v2, 32);
+    }
+
+    void compress(uint64_t word) {
+        m_v3 ^= word;
+        round();
+        round();
+        m_v0 ^= word;
+    }
+
+    uint64_t m_v0, m_v1, m_v2, m_v3;
+    uint64_t m_tail = 0;
+    int m_pending = 0;          // Bytes in m_tail, waiting for a whole word
+    uint64_t m_length = 0;
+};
+
+const size_t digestDigits = 16;
+
+// The seal's key from 32 hex digits, or the built-in one for an empty string
+SipHash sealHash(const string& key) {
+    if (key.empty()) {
+        return SipHash(0x6e6f726d616c697aULL, 0x65642062792070ULL);
+    }
+    uint64_t k[2] = { 0, 0 };
+    for (size_t i = 0; i < 32; i++) {
+        // Bytes in order, each half read as a little endian number like the reference does
+        k[i / 16] |= static_cast<uint64_t>(hexValue(key[i ^ 1])) << (4 * (i % 16));
+    }
+    return SipHash(k[0], k[1]);
+}
+
+string digestText(uint64_t digest) {
+    char text[digestDigits + 1];
+    snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(digest));
+    return text;
+}
+
+// Where the value of the last normalized marker in the file starts and ends (the parentheses
+// excluded), false when there is none
+bool findMarker(string_view file, size_t& start, size_t& end) {
+    string key = string("/") + normalizedMarkerKey;
+    for (size_t pos = file.rfind(key); pos != string_view::npos; pos = pos == 0 ? string_view::npos : file.rfind(key, pos - 1)) {
+        size_t value = pos + key.size();
+        skipWhitespace(file, value);
+        if (value >= file.size() || file[value] != '(') {
+            continue;
+        }
+        size_t close = file.find(')', value);
+        if (close == string_view::npos) {
+            return false;
+        }
+        start = value + 1;
+        end = close;
+        return true;
+    }
+    return false;
+}
+
+// Offset of the digest of marker's seal in the file, npos unless the last marker is marker's
+size_t findDigest(string_view file, const string& marker) {
+    size_t start = 0;
+    size_t end = 0;
+    if (!findMarker(file, start, end) || end - start != marker.size() + 1 + digestDigits
+        || file.compare(start, marker.size(), marker) != 0 || file[start + marker.size()] != ' ') {
+        return string_view::npos;
+    }
+    return start + marker.size() + 1;
+}
+
+// Digest of the file with the digits at digest read as zeros
+uint64_t sealDigest(string_view file, size_t digest, const string& key) {
+    SipHash hash = sealHash(key);
+    hash.update(file.substr(0, digest));
+    hash.update(string(digestDigits, '0'));
+    hash.update(file.substr(digest + digestDigits));
+    return hash.finish();
+}
+
+// Offset of object number from a classic xref table starting at xref, 0 when not found
+uint64_t findXrefEntry(string_view file, size_t xref, size_t trailer, uint64_t objectNumber) {
+    size_t pos = xref + 4;
+    uint64_t first = 0;
+    uint64_t count = 0;
+    while (pos < trailer && parseNumber(file, pos, first) && parseNumber(file, pos, count)) {
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t offset = 0;
+            uint64_t generation = 0;
+            if (!parseNumber(file, pos, offset) || !parseNumber(file, pos, generation)) {
+                return 0;
+            }
+            skipWhitespace(file, pos);
+            if (pos >= file.size()) {
+                return 0;
+            }
+            char type = file[pos++];
+            if (first + i == objectNumber) {
+                return type == 'n' ? offset : 0;
+            }
+        }
+    }
+    return 0;
+}
+
+string pdfTextString(const string& text) {
+    // Plain ASCII goes in a literal string, anything else as UTF-16BE with a byte order mark
+    bool ascii = true;
+    for (unsigned char c : text) {
+        if (c < 0x20 || c >= 0x7F) {
+            ascii = false;
+        }
+    }
+
+    ostringstream out;
+    if (ascii) {
+        out << '(';
+        for (char c : text) {
+            if (c == '(' || c == ')' || c == '\\') {
+                out << '\\';
+            }
+            out << c;
+        }
+        out << ')';
+        return out.str();
+    }
+
+    static const char hex[] = "0123456789ABCDEF";
+    auto putUnit = [&out](uint32_t unit) {
+        for (int shift = 12; shift >= 0; shift -= 4) {
+            out << hex[(unit >> shift) & 0xF];
+        }
+    };
+    out << "<FEFF";
+    for (size_t i = 0; i < text.size();) {
+        unsigned char c = text[i];
+        uint32_t codepoint = c;
+        int extra = 0;
+        if (c >= 0xF0) { codepoint = c & 0x07; extra = 3; }
+        else if (c >= 0xE0) { codepoint = c & 0x0F; extra = 2; }
+        else if (c >= 0xC0) { codepoint = c & 0x1F; extra = 1; }
+        i++;
+        for (; extra > 0 && i < text.size(); extra--, i++) {
+            codepoint = (codepoint << 6) | (static_cast<unsigned char>(text[i]) & 0x3F);
+        }
+        if (codepoint >= 0x10000) {
+            codepoint -= 0x10000;
+            putUnit(0xD800 | (codepoint >> 10));
+            putUnit(0xDC00 | (codepoint & 0x3FF));
+        } else {
+            putUnit(codepoint);
+        }
+    }
+    out << '>';
+    return out.str();
+}
+
+// Old /Info dictionary to blank (npos when there is none) and the bytes to append
+struct InfoUpdate {
+    size_t infoStart = string_view::npos;
+    size_t infoEnd = string_view::npos;
+    bool newline = false;
+    string tail;
+    size_t digest = 0;          // Where the seal's digest goes in tail
+};
+
+// Everything needed to write the update, worked out before a byte of output is written
+bool planInfoUpdate(string_view file, const string& title, const string& marker, InfoUpdate& update) {
+    // Only plain single revision files: one classic xref table and one trailer. Anything else
+    // (incremental updates, linearization, xref streams) may hold older metadata we'd miss.
+    if (countOccurrences(file, "startxref") != 1 || countOccurrences(file, "trailer") != 1) {
+        return false;
+    }
+    size_t pos = file.rfind("startxref") + 9;
+    uint64_t xref = 0;
+    if (!parseNumber(file, pos, xref) || xref >= file.size() || file.compare(xref, 4, "xref") != 0) {
+        return false;
+    }
+
+    size_t trailer = file.find("trailer", xref);
+    size_t trailerStart = trailer == string_view::npos ? trailer : file.find("<<", trailer);
+    size_t trailerEnd = trailerStart == string_view::npos ? trailerStart : skipDictionary(file, trailerStart);
+    if (trailerEnd == string_view::npos) {
+        return false;
+    }
+    string_view dict = file.substr(trailerStart, trailerEnd - trailerStart);
+
+    uint64_t size = 0;
+    uint64_t rootNumber = 0;
+    uint64_t rootGeneration = 0;
+    size_t key = dict.find("/Size");
+    size_t rootKey = dict.find("/Root");
+    if (key == string_view::npos || !parseNumber(dict, key += 5, size)
+        || rootKey == string_view::npos || !parseReference(dict, rootKey + 5, rootNumber, rootGeneration)) {
+        return false;
+    }
+    // An XMP /Metadata stream on the catalog repeats (and adds to) what /Info says. Dropping it
+    // would mean rewriting the catalog, so those documents take the full path, which removes it.
+    uint64_t rootOffset = findXrefEntry(file, xref, trailer, rootNumber);
+    size_t rootStart = rootOffset == 0 ? string_view::npos : file.find("<<", rootOffset);
+    size_t rootEnd = rootStart == string_view::npos ? rootStart : skipDictionary(file, rootStart);
+    if (rootEnd == string_view::npos || rootStart > file.find("endobj", rootOffset)
+        || containsName(file.substr(rootStart, rootEnd - rootStart), "Metadata")) {
+        return false;
+    }
+
+    string id;
+    size_t idKey = dict.find("/ID");
+    if (idKey != string_view::npos) {
+        size_t open = dict.find('[', idKey);
+        size_t close = dict.find(']', idKey);
+        if (open == string_view::npos || close == string_view::npos || close < open) {
+            return false;
+        }
+        id = string(dict.substr(open, close - open + 1));
+    }
+
+    // The old /Info is blanked in place (same length, so every xref offset stays valid)
+    // rather than left behind for anyone to read out of the file
+    size_t infoStart = string_view::npos;
+    size_t infoEnd = string_view::npos;
+    size_t infoKey = dict.find("/Info");
+    if (infoKey != string_view::npos) {
+        uint64_t infoNumber = 0;
+        uint64_t infoGeneration = 0;
+        if (!parseReference(dict, infoKey + 5, infoNumber, infoGeneration)) {
+            return false;
+        }
+        uint64_t offset = findXrefEntry(file, xref, trailer, infoNumber);
+        infoStart = offset == 0 ? string_view::npos : file.find("<<", offset);
+        infoEnd = infoStart == string_view::npos ? infoStart : skipDictionary(file, infoStart);
+        if (infoEnd == string_view::npos || infoStart > file.find("endobj", offset)) {
+            return false;
+        }
+    }
+
+    update.infoStart = infoStart;
+    update.infoEnd = infoEnd;
+    update.newline = file.back() != '\n' && file.back() != '\r';
+
+    // The appended section, with offsets counted from the end of the original bytes so the
+    // output doesn't need to be seekable
+    uint64_t infoOffset = file.size() + (update.newline ? 1 : 0);
+    ostringstream info;
+    info << size << " 0 obj\n"
+         << "<< /Title " << pdfTextString(title)
+         << " /Author () /Creator () /Producer () /Subject () /Keywords ()"
+         << " /" << normalizedMarkerKey << " " << pdfTextString(sealPlaceholder(marker)) << " >>\n"
+         << "endobj\n";
+    update.tail = info.str();
+    update.digest = update.tail.rfind(string(digestDigits, '0'));
+
+    char entry[21];
+    snprintf(entry, sizeof(entry), "%010llu 00000 n\r\n", static_cast<unsigned long long>(infoOffset));
+    uint64_t updateXref = infoOffset + update.tail.size();
+    ostringstream xrefSection;
+    xrefSection << "xref\n" << size << " 1\n" << entry
+                << "trailer\n"
+                << "<< /Size " << size + 1 << " /Root " << rootNumber << ' ' << rootGeneration << " R"
+                << " /Info " << size << " 0 R /Prev " << xref;
+    if (!id.empty()) {
+        xrefSection << " /ID " << id;
+    }
+    xrefSection << " >>\n"
+                << "startxref\n" << updateXref << "\n%%EOF\n";
+    update.tail += xrefSection.str();
+    return true;
+}
+
+// Writes the update sealed, hashing the bytes as they go out so the output can be a pipe
+void writeInfoUpdate(string_view file, const InfoUpdate& update, ostream& out, const string& key) {
+    SipHash hash = sealHash(key);
+    auto put = [&hash, &out](string_view bytes) {
+        hash.update(bytes);
+        out.write(bytes.data(), bytes.size());
+    };
+    if (update.infoStart != string_view::npos) {
+        put(file.substr(0, update.infoStart));
+        put("<<>>" + string(update.infoEnd - update.infoStart - 4, ' '));
+        put(file.substr(update.infoEnd));
+    } else {
+        put(file);
+    }
+    if (update.newline) {
+        put("\n");
+    }
+    string tail = update.tail;
+    hash.update(tail);
+    tail.replace(update.digest, digestDigits, digestText(hash.finish()));
+    out << tail;
+}
+
+} // namespace
+
+bool PreflightResult::hasActiveContent() const {
+    // Object streams and encryption could hide active content from the scan
+    return javaScript || openAction || additionalActions || activeActions || objectStreams || encrypted;
+}
+
+bool PreflightResult::needsFullNormalize() const {
+    return acroForm || widgets || hasActiveContent();
+}
+
+string PreflightResult::describe() const {
+    string found;
+    auto add = [&found](bool flag, const char* name) {
+        if (flag) {
+            found += found.empty() ? name : string(", ") + name;
+        }
+    };
+    add(acroForm, "AcroForm");
+    add(widgets, "widgets");
+    add(javaScript, "JavaScript");
+    add(openAction, "OpenAction");
+    add(additionalActions, "additional actions");
+    add(activeActions, "active actions");
+    add(objectStreams, "object streams");
+    add(escapedNames, "escaped names");
+    add(encrypted, "encryption");
+    return found.empty() ? "nothing to normalize" : found;
+}
+
+PreflightResult preflightScan(const char* data, size_t size) {
+    PreflightResult result;
+    const char* end = data + size;
+    const char* p = data;
+    while ((p = findSlash(p, end)) != end) {
+        const char* name = ++p;
+        while (p < end && !isDelimiter(*p)) {
+            p++;
+        }
+        checkName(string_view(name, p - name), result);
+    }
+    return result;
+}
+
+string sealPlaceholder(const string& marker) {
+    return marker + " " + string(digestDigits, '0');
+}
+
+bool validSealKey(const string& key) {
+    return key.empty() || (key.size() == 32 && all_of(key.begin(), key.end(), [](char c) { return hexValue(c) >= 0; }));
+}
+
+bool sealOutput(string& pdf, const string& marker, const string& key) {
+    size_t digest = findDigest(pdf, marker);
+    if (digest == string::npos || pdf.compare(digest, digestDigits, string(digestDigits, '0')) != 0) {
+        return false;
+    }
+    pdf.replace(digest, digestDigits, digestText(sealDigest(pdf, digest, key)));
+    return true;
+}
+
+bool sealOutput(const string& path, const string& marker, const string& key) {
+    string text;
+    size_t digest = string::npos;
+    {
+        MappedFile output(path);
+        string_view file(output.data(), output.size());
+        digest = findDigest(file, marker);
+        if (digest == string_view::npos || file.compare(digest, digestDigits, string(digestDigits, '0')) != 0) {
+            return false;
+        }
+        text = digestText(sealDigest(file, digest, key));
+    }
+    // Only the sixteen digits change, written in place
+    int fd = open(path.c_str(), O_WRONLY);
+    bool written = fd >= 0 && pwrite(fd, text.data(), text.size(), static_cast<off_t>(digest))
+        == static_cast<ssize_t>(text.size());
+    if (fd >= 0 && close(fd) != 0) {
+        written = false;
+    }
+    if (!written) {
+        throw runtime_error("Cannot seal " + path);
+    }
+    return true;
+}
+
+bool sealedOutput(const char* data, size_t size, const string& marker, const string& key) {
+    string_view file(data, size);
+    size_t digest = findDigest(file, marker);
+    return digest != string_view::npos
+        && file.compare(digest, digestDigits, digestText(sealDigest(file, digest, key))) == 0;
+}
+
+bool writeInfoUpdate(const MappedFile& input, const string& outputPath, const string& title, const string& marker,
+                     const string& key) {
+    string_view file(input.data(), input.size());
+    InfoUpdate update;
+    if (!planInfoUpdate(file, title, marker, update)) {
+        return false;
+    }
+    ofstream out(outputPath, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    writeInfoUpdate(file, update, out, key);
+    return static_cast<bool>(out);
+}
+
+bool writeInfoUpdate(const char* data, size_t size, ostream& output, const string& title, const string& marker,
+                     const string& key) {
+    string_view file(data, size);
+    InfoUpdate update;
+    if (!planInfoUpdate(file, title, marker, update)) {
+        return false;
+    }
+    writeInfoUpdate(file, update, output, key);
+    return static_cast<bool>(output);
+}
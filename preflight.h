@@ -0,0 +1,78 @@
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+
+// Read-only view of a whole input file, memory mapped when possible
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+    std::string m_buffer;   // Fallback copy when the file can't be mapped
+};
+
+// What a raw scan of the file bytes found, before PoDoFo parses anything. Every flag errs on
+// the side of "present": a token inside binary stream data counts, #-escaped names are decoded,
+// and anything the scan can't see into (object streams, encryption) sends the file down the full path
+struct PreflightResult {
+    bool acroForm = false;
+    bool widgets = false;
+    bool javaScript = false;
+    bool openAction = false;
+    bool additionalActions = false;
+    bool activeActions = false;
+    bool objectStreams = false;
+    bool escapedNames = false;
+    bool encrypted = false;
+
+    bool hasActiveContent() const;
+    bool needsFullNormalize() const;
+    std::string describe() const;
+};
+
+PreflightResult preflightScan(const char* data, size_t size);
+
+// Key of the marker the normalizer stamps on its outputs. The value is "<version> <settings hash>
+// <seal>", the seal being a keyed SipHash-2-4 of the whole output with its own sixteen hex digits
+// read as zeros, so an output fed back in can be trusted to be one and passed through unchanged.
+const char* const normalizedMarkerKey = "PdfNormalized";
+
+// Marker value to stamp before saving, with the seal's digits still zero for sealOutput() to fill in
+std::string sealPlaceholder(const std::string& marker);
+
+// Whether key can seal outputs: 32 hex digits, or empty for the built-in key
+bool validSealKey(const std::string& key);
+
+// Fill in the seal of marker's placeholder, the last marker in the output. False when there is
+// none to fill in. The file variant rewrites the sixteen digits in place, throwing when it can't.
+bool sealOutput(std::string& pdf, const std::string& marker, const std::string& key);
+bool sealOutput(const std::string& path, const std::string& marker, const std::string& key);
+
+// Whether the last marker in the file is marker with a seal that matches the bytes under key
+bool sealedOutput(const char* data, size_t size, const std::string& marker, const std::string& key);
+
+// Append an incremental update that replaces /Info with the normalized metadata (blank author,
+// creator, producer, subject and keywords, title set to title, marker sealed with key under
+// normalizedMarkerKey).
+// The input must end in a classic xref table and its catalog must not have an XMP /Metadata stream,
+// returns false without writing anything when it doesn't.
+bool writeInfoUpdate(const MappedFile& input, const std::string& outputPath, const std::string& title,
+                     const std::string& marker, const std::string& key);
+
+// Same, for a document already in memory, written to output (which doesn't need to be seekable)
+bool writeInfoUpdate(const char* data, size_t size, std::ostream& output, const std::string& title,
+                     const std::string& marker, const std::string& key);
+
+#endif // PREFLIGHT_H
@@ -0,0 +1,222 @@
+// The pdfnorm Python extension: the normalizer in process, for web workers that would otherwise
+// start a normalizer process per document. Built with cmake -DPYTHON_MODULE=ON.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "budget.h"
+#include "normalizer.h"
+#include "preflight.h"
+
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+PyObject* normalizeError = nullptr;
+PyObject* budgetError = nullptr;
+
+// The output, collected in one string that becomes the returned bytes
+class OutputBuffer : public streambuf {
+public:
+    const string& data() const { return m_data; }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            m_data.push_back(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    streamsize xsputn(const char* data, streamsize size) override {
+        m_data.append(data, static_cast<size_t>(size));
+        return size;
+    }
+
+private:
+    string m_data;
+};
+
+// The keyword arguments both normalize functions take after their positional ones
+struct KeywordOptions {
+    int dedupeStreams = 0;
+    int preflight = 1;
+    const char* repair = "auto";
+    unsigned threads = 0;
+    double wallSeconds = 0;
+    double cpuSeconds = 0;
+    unsigned long long decodedBytes = 0;
+    unsigned long long heapBytes = 0;
+    const char* templateDirectory = nullptr;
+    const char* markerKey = nullptr;
+
+    // Into options, false with a ValueError set when one of them is out of range
+    bool apply(NormalizeOptions& options) const {
+        options.dedupeStreams = dedupeStreams != 0;
+        options.preflight = preflight != 0;
+        options.threads = threads;
+        options.limits.wallSeconds = wallSeconds;
+        options.limits.cpuSeconds = cpuSeconds;
+        options.limits.decodedBytes = decodedBytes;
+        options.limits.heapBytes = heapBytes;
+        options.templateDirectory = templateDirectory ? templateDirectory : "";
+        options.markerKey = markerKey ? markerKey : "";
+        if (!validSealKey(options.markerKey)) {
+            PyErr_SetString(PyExc_ValueError, "marker_key must be 32 hex digits");
+            return false;
+        }
+        if (strcmp(repair, "auto") == 0) {
+            options.repair = RepairMode::Auto;
+        } else if (strcmp(repair, "always") == 0) {
+            options.repair = RepairMode::Always;
+        } else if (strcmp(repair, "never") == 0) {
+            options.repair = RepairMode::Never;
+        } else {
+            PyErr_Format(PyExc_ValueError, "repair must be auto, always or never, not %s", repair);
+            return false;
+        }
+        return true;
+    }
+};
+
+PyObject* raiseStatus(int status, const string& message) {
+    PyErr_SetString(status == exitBudgetExceeded ? budgetError : normalizeError, message.c_str());
+    return nullptr;
+}
+
+PyObject* normalize(PyObject*, PyObject* args, PyObject* keywords) {
+    static const char* names[] = { "data", "title", "dedupe_streams", "preflight", "repair", "threads",
+                                   "max_wall_seconds", "max_cpu_seconds", "max_decoded_bytes",
+                                   "max_heap_bytes", "template_directory", "marker_key", nullptr };
+    Py_buffer input;
+    const char* title = "";
+    KeywordOptions given;
+    if (!PyArg_ParseTupleAndKeywords(args, keywords, "y*|s$ppsIddKKzz", const_cast<char**>(names), &input, &title,
+                                     &given.dedupeStreams, &given.preflight, &given.repair, &given.threads,
+                                     &given.wallSeconds, &given.cpuSeconds, &given.decodedBytes, &given.heapBytes,
+                                     &given.templateDirectory, &given.markerKey)) {
+        return nullptr;
+    }
+    NormalizeOptions options;
+    if (!given.apply(options)) {
+        PyBuffer_Release(&input);
+        return nullptr;
+    }
+
+    // Load, normalize and save without the GIL, so other Python threads keep running and
+    // several documents can be normalized at once. The budget lives on this thread.
+    OutputBuffer buffer;
+    ostream output(&buffer);
+    string documentTitle = title;
+    string message;
+    int status = 0;
+    Py_BEGIN_ALLOW_THREADS
+    status = normalizeBufferStatus(static_cast<const char*>(input.buf), static_cast<size_t>(input.len),
+                                   documentTitle, output, options, message);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&input);
+
+    if (status != 0) {
+        return raiseStatus(status, message);
+    }
+    return PyBytes_FromStringAndSize(buffer.data().data(), static_cast<Py_ssize_t>(buffer.data().size()));
+}
+
+PyObject* normalizeFile(PyObject*, PyObject* args, PyObject* keywords) {
+    static const char* names[] = { "input_path", "output_path", "dedupe_streams", "preflight", "repair", "threads",
+                                   "max_wall_seconds", "max_cpu_seconds", "max_decoded_bytes",
+                                   "max_heap_bytes", "template_directory", "marker_key", nullptr };
+    const char* inputPath = nullptr;
+    const char* outputPath = nullptr;
+    KeywordOptions given;
+    if (!PyArg_ParseTupleAndKeywords(args, keywords, "ss|$ppsIddKKzz", const_cast<char**>(names), &inputPath,
+                                     &outputPath, &given.dedupeStreams, &given.preflight, &given.repair,
+                                     &given.threads, &given.wallSeconds, &given.cpuSeconds, &given.decodedBytes,
+                                     &given.heapBytes, &given.templateDirectory, &given.markerKey)) {
+        return nullptr;
+    }
+    NormalizeOptions options;
+    if (!given.apply(options)) {
+        return nullptr;
+    }
+
+    // The input is mapped and the output written by the normalizer itself, neither passes
+    // through Python; the ETag is read back from the output while the GIL is still released
+    string input = inputPath;
+    string output = outputPath;
+    string message;
+    string tag;
+    int status = 0;
+    Py_BEGIN_ALLOW_THREADS
+    status = normalizeFileStatus(input, output, options, message);
+    if (status == 0) {
+        try {
+            MappedFile written(output);
+            tag = outputTag(written.data(), written.size());
+        } catch (const std::exception& e) {
+            status = 2;
+            message = string("Exception: ") + e.what();
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    if (status != 0) {
+        return raiseStatus(status, message);
+    }
+    return PyUnicode_FromStringAndSize(tag.data(), static_cast<Py_ssize_t>(tag.size()));
+}
+
+PyObject* etag(PyObject*, PyObject* args) {
+    Py_buffer data;
+    if (!PyArg_ParseTuple(args, "y*", &data)) {
+        return nullptr;
+    }
+    string tag = outputTag(static_cast<const char*>(data.buf), static_cast<size_t>(data.len));
+    PyBuffer_Release(&data);
+    return PyUnicode_FromStringAndSize(tag.data(), static_cast<Py_ssize_t>(tag.size()));
+}
+
+PyMethodDef methods[] = {
+    { "normalize", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)(void)>(normalize)),
+      METH_VARARGS | METH_KEYWORDS,
+      "normalize(data, title='', *, dedupe_streams=False, preflight=True, repair='auto', threads=0,\n"
+      "          max_wall_seconds=0, max_cpu_seconds=0, max_decoded_bytes=0, max_heap_bytes=0,\n"
+      "          template_directory=None, marker_key=None) -> bytes\n\n"
+      "Normalize the PDF in data and return the result. The options match the command line ones, 0 leaves\n"
+      "a limit off. The GIL is released while the document is processed. Raises BudgetExceeded when a\n"
+      "limit is passed and Error when the document can't be normalized. The heap limit counts the growth\n"
+      "of the whole process, which other threads normalizing at the same time add to." },
+    { "normalize_file", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)(void)>(normalizeFile)),
+      METH_VARARGS | METH_KEYWORDS,
+      "normalize_file(input_path, output_path, *, <the options of normalize>) -> str\n\n"
+      "Normalize the PDF at input_path into output_path, titled after the input's file name, and return\n"
+      "the output's ETag. The input is mapped rather than read into memory and the output is written\n"
+      "straight to its file, so a large document costs Python nothing. Raises like normalize." },
+    { "etag", etag, METH_VARARGS, "etag(data) -> str\n\nETag of a normalized output, quoted for the header." },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+PyModuleDef module = { PyModuleDef_HEAD_INIT, "pdfnorm", "PDF form normalizer", -1, methods,
+                       nullptr, nullptr, nullptr, nullptr };
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_pdfnorm(void) {
+    PyObject* pdfnorm = PyModule_Create(&module);
+    if (!pdfnorm) {
+        return nullptr;
+    }
+    normalizeError = PyErr_NewException("pdfnorm.Error", nullptr, nullptr);
+    budgetError = PyErr_NewException("pdfnorm.BudgetExceeded", normalizeError, nullptr);
+    if (!normalizeError || !budgetError
+        || PyModule_AddObject(pdfnorm, "Error", (Py_INCREF(normalizeError), normalizeError)) < 0
+        || PyModule_AddObject(pdfnorm, "BudgetExceeded", (Py_INCREF(budgetError), budgetError)) < 0) {
+        Py_DECREF(pdfnorm);
+        return nullptr;
+    }
+    return pdfnorm;
+}
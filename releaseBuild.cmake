@@ -0,0 +1,34 @@
+# Release tuning, included by both CMakeLists. -DENABLE_LTO=ON builds with link time optimization;
+# -DPGO=GENERATE builds instrumented binaries that leave their profiles in PGO_PROFILE_DIR, and
+# -DPGO=USE rebuilds the same build directory with them. pgoBuild.sh runs the whole flow.
+option(ENABLE_LTO "Build with link time optimization" OFF)
+if(ENABLE_LTO)
+    include(CheckIPOSupported)
+    check_ipo_supported(RESULT LTO_SUPPORTED OUTPUT LTO_ERROR)
+    if(LTO_SUPPORTED)
+        set(CMAKE_INTERPROCEDURAL_OPTIMIZATION ON)
+    else()
+        message(WARNING "Link time optimization isn't supported: ${LTO_ERROR}")
+    endif()
+endif()
+
+set(PGO OFF CACHE STRING "Profile guided optimization: OFF, GENERATE or USE")
+set_property(CACHE PGO PROPERTY STRINGS OFF GENERATE USE)
+set(PGO_PROFILE_DIR "${CMAKE_BINARY_DIR}/pgo-profiles" CACHE PATH "Where the training runs leave their profiles")
+if(PGO STREQUAL "GENERATE")
+    # The counters are updated atomically, the normalizer trains with its worker threads on
+    add_compile_options(-fprofile-generate=${PGO_PROFILE_DIR} -fprofile-update=atomic)
+    add_link_options(-fprofile-generate=${PGO_PROFILE_DIR})
+elseif(PGO STREQUAL "USE")
+    if(CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+        # pgoBuild.sh merges the .profraw files into this one
+        set(PGO_FLAGS -fprofile-use=${PGO_PROFILE_DIR}/default.profdata)
+    else()
+        # GCC finds the .gcda files by object path, so this must be the build directory that trained
+        set(PGO_FLAGS -fprofile-use=${PGO_PROFILE_DIR} -fprofile-correction -Wno-missing-profile)
+    endif()
+    add_compile_options(${PGO_FLAGS})
+    add_link_options(${PGO_FLAGS})
+elseif(PGO)
+    message(FATAL_ERROR "PGO must be OFF, GENERATE or USE, not ${PGO}")
+endif()
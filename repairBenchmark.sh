@@ -0,0 +1,85 @@
+#!/bin/sh
+# Times the xref repair (--repair=always) against PoDoFo's own recovery (--repair=never) and the
+# default (--repair=auto, which repairs only when loading fails) on damaged documents:
+#   ./repairBenchmark.sh [WORK_DIR] [RUNS]
+# Builds an -O2 normalizer in WORK_DIR, unless BINARY names one already built. The documents are
+# broken-xref.pdf from syntheticForms.py, copies of the sample PDFs and forms-large.pdf with the
+# xref and trailer cut off or the startxref offset wrong, cmake-build-debug/broken.pdf, and the
+# PDFs in DAMAGED=DIR. Prints the best of RUNS (5) wall times per mode in milliseconds, followed
+# by "fail" when the document didn't normalize that way. TARGET and ASSETS are as for pgoBuild.sh.
+set -e
+
+source=$(cd "$(dirname "$0")" && pwd)
+work=${1:-$source/build-repair-benchmark}
+runs=${2:-5}
+mkdir -p "$work"
+work=$(cd "$work" && pwd)
+target=${TARGET:-untitled}
+assets=${ASSETS:-$source}
+
+binary=$BINARY
+if [ -z "$binary" ]; then
+    cmake -S "$source" -B "$work/O2" -DCMAKE_BUILD_TYPE=None -DCMAKE_CXX_FLAGS="-O2 -DNDEBUG" > /dev/null
+    cmake --build "$work/O2" -j "$(nproc)" --target "$target" > /dev/null
+    binary=$work/O2/$target
+fi
+
+corpus=$work/damaged
+rm -rf "$corpus"
+python3 "$source/syntheticForms.py" "$work/synthetic" > /dev/null
+mkdir -p "$corpus"
+cp "$work/synthetic/broken-xref.pdf" "$corpus"/
+
+# Two kinds of damage to intact documents: everything from the last xref on cut off (a truncated
+# download), and the startxref offset pointing at the wrong place
+python3 - "$corpus" "$assets"/*.pdf "$work/synthetic/forms-large.pdf" <<'EOF'
+import os
+import re
+import sys
+
+corpus = sys.argv[1]
+for path in sys.argv[2:]:
+    with open(path, "rb") as f:
+        data = f.read()
+    name = os.path.splitext(os.path.basename(path))[0]
+    xref = max(data.rfind(b"\nxref"), data.rfind(b"\rxref"))
+    if xref > 0:
+        with open(os.path.join(corpus, name + "-truncated.pdf"), "wb") as f:
+            f.write(data[:xref + 1])
+    startxref = data.rfind(b"startxref")
+    offset = re.match(rb"startxref\s+(\d+)", data[startxref:]) if startxref >= 0 else None
+    if offset:
+        wrong = str(int(offset.group(1)) // 2).encode().rjust(len(offset.group(1)))
+        with open(os.path.join(corpus, name + "-bad-startxref.pdf"), "wb") as f:
+            f.write(data[:startxref + offset.start(1)] + wrong + data[startxref + offset.end(1):])
+EOF
+[ -f "$source/cmake-build-debug/broken.pdf" ] && cp "$source/cmake-build-debug/broken.pdf" "$corpus"/
+[ -n "$DAMAGED" ] && cp "$DAMAGED"/*.pdf "$corpus"/
+
+# Best wall time of the runs in milliseconds, and whether the last one failed
+best() {
+    fastest=
+    result=
+    i=0
+    while [ $i -lt "$runs" ]; do
+        start=$(date +%s%N)
+        if "$binary" --templates="$assets" --output-dir="$work/output" --repair="$1" "$2" out.pdf > /dev/null 2>&1; then
+            result=
+        else
+            result=" fail"
+        fi
+        elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+        if [ -z "$fastest" ] || [ "$elapsed" -lt "$fastest" ]; then
+            fastest=$elapsed
+        fi
+        i=$((i + 1))
+    done
+    echo "$fastest$result"
+}
+
+mkdir -p "$work/output"
+printf '%-32s %12s %12s %12s\n' document always never auto
+for pdf in "$corpus"/*.pdf; do
+    printf '%-32s %12s %12s %12s\n' "$(basename "$pdf")" "$(best always "$pdf")" "$(best never "$pdf")" \
+        "$(best auto "$pdf")"
+done
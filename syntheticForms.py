@@ -0,0 +1,148 @@
+"""Synthetic PDFs covering the normalizer's paths, for PGO training and benchmarks:
+
+    python3 syntheticForms.py OUTPUT_DIR
+
+forms-small.pdf    a page of check boxes, radio groups and text fields
+forms-large.pdf    thousands of fields over many pages, past the parallel field threshold
+active.pdf         no form, but JavaScript in OpenAction, page and link actions
+plain.pdf          nothing to normalize, the metadata only update path
+broken-xref.pdf    forms-small.pdf with every xref offset wrong, the xref repair path
+"""
+import os
+import sys
+
+
+class Writer:
+    """Numbered objects written out with a classic xref table"""
+
+    def __init__(self):
+        self.objects = {}
+
+    def reserve(self):
+        number = len(self.objects) + 1
+        self.objects[number] = None
+        return number
+
+    def add(self, body, number=None):
+        number = number or self.reserve()
+        self.objects[number] = body.encode('latin-1') if isinstance(body, str) else body
+        return number
+
+    def stream(self, data, extra=''):
+        return self.add(b'<< /Length %d %s >>\nstream\n' % (len(data), extra.encode()) + data + b'\nendstream')
+
+    def save(self, path, root, info=None, offset_error=0):
+        out = bytearray(b'%PDF-1.7\n%\xe2\xe3\xcf\xd3\n')
+        offsets = {}
+        for number in sorted(self.objects):
+            offsets[number] = len(out)
+            out += b'%d 0 obj\n' % number + self.objects[number] + b'\nendobj\n'
+        xref = len(out)
+        out += b'xref\n0 %d\n0000000000 65535 f\r\n' % (len(self.objects) + 1)
+        for number in sorted(self.objects):
+            out += b'%010d 00000 n\r\n' % (offsets[number] + offset_error)
+        trailer = '<< /Size %d /Root %d 0 R' % (len(self.objects) + 1, root)
+        if info:
+            trailer += ' /Info %d 0 R' % info
+        out += b'trailer\n' + trailer.encode() + b' >>\nstartxref\n%d\n%%%%EOF\n' % xref
+        with open(path, 'wb') as f:
+            f.write(out)
+
+
+def form(path, pages, fields_per_page, offset_error=0):
+    w = Writer()
+    catalog, page_tree, acroform = w.reserve(), w.reserve(), w.reserve()
+    box = w.stream(b'q 0 0 1 rg 0 0 12 12 re f Q', '/Type /XObject /Subtype /Form /BBox [0 0 12 12]')
+    empty = w.stream(b'', '/Type /XObject /Subtype /Form /BBox [0 0 12 12]')
+    font = w.add('<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>')
+    kids, fields = [], []
+    for page_index in range(pages):
+        page = w.reserve()
+        annots = []
+        for i in range(fields_per_page):
+            name = 'p%df%d' % (page_index, i)
+            x, y = 40 + (i % 10) * 50, 740 - (i // 10) * 20
+            rect = '[%d %d %d %d]' % (x, y, x + 12, y + 12)
+            kind = i % 3
+            if kind == 0:
+                widget = w.add('<< /Type /Annot /Subtype /Widget /FT /Btn /T (%s) /V /Off /AS /Off /Rect %s /P %d 0 R'
+                               ' /MK << /CA (4) >> /DA (/ZaDb 0 Tf 0 g)'
+                               ' /AP << /N << /Yes %d 0 R /Off %d 0 R >> /D << /Yes %d 0 R /Off %d 0 R >> >> >>'
+                               % (name, rect, page, box, empty, box, empty))
+                annots.append(widget)
+                fields.append(widget)
+            elif kind == 1:
+                group = w.reserve()
+                radios = []
+                for choice in ('A', 'B'):
+                    radio = w.add('<< /Type /Annot /Subtype /Widget /Parent %d 0 R /AS /Off /Rect %s /P %d 0 R'
+                                  ' /MK << /CA (l) >> /AP << /N << /%s %d 0 R /Off %d 0 R >> >> >>'
+                                  % (group, rect, page, choice, box, empty))
+                    radios.append(radio)
+                    annots.append(radio)
+                w.add('<< /FT /Btn /Ff 49152 /T (%s) /V /Off /DA (/ZaDb 0 Tf 0 g) /Kids [%s] >>'
+                      % (name, ' '.join('%d 0 R' % r for r in radios)), group)
+                fields.append(group)
+            else:
+                widget = w.add('<< /Type /Annot /Subtype /Widget /FT /Tx /T (%s) /V (value %d) /Rect [%d %d %d %d]'
+                               ' /P %d 0 R /DA (/Helv 9 Tf 0 g) >>' % (name, i, x, y, x + 45, y + 12, page))
+                annots.append(widget)
+                fields.append(widget)
+        content = w.stream(b'BT /F1 12 Tf 40 780 Td (Synthetic form page) Tj ET')
+        w.add('<< /Type /Page /Parent %d 0 R /MediaBox [0 0 612 792] /Contents %d 0 R'
+              ' /Resources << /Font << /F1 %d 0 R >> >> /Annots [%s] >>'
+              % (page_tree, content, font, ' '.join('%d 0 R' % a for a in annots)), page)
+        kids.append(page)
+    w.add('<< /Type /Pages /Kids [%s] /Count %d >>' % (' '.join('%d 0 R' % k for k in kids), len(kids)), page_tree)
+    w.add('<< /Fields [%s] /DA (/Helv 0 Tf 0 g) /DR << /Font << /Helv %d 0 R >> >> >>'
+          % (' '.join('%d 0 R' % f for f in fields), font), acroform)
+    w.add('<< /Type /Catalog /Pages %d 0 R /AcroForm %d 0 R >>' % (page_tree, acroform), catalog)
+    info = w.add('<< /Title (Synthetic) /Author (syntheticForms.py) /Producer (syntheticForms.py) >>')
+    w.save(path, catalog, info, offset_error)
+
+
+def active(path):
+    w = Writer()
+    catalog, page_tree, page = w.reserve(), w.reserve(), w.reserve()
+    script = w.add("<< /S /JavaScript /JS (app.alert\\('synthetic'\\);) >>")
+    link = w.add('<< /Type /Annot /Subtype /Link /Rect [40 700 200 720] /A %d 0 R >>' % script)
+    content = w.stream(b'BT /F1 12 Tf 40 780 Td (Active content) Tj ET')
+    w.add('<< /Type /Page /Parent %d 0 R /MediaBox [0 0 612 792] /Contents %d 0 R /Annots [%d 0 R]'
+          ' /AA << /O %d 0 R >> >>' % (page_tree, content, link, script), page)
+    w.add('<< /Type /Pages /Kids [%d 0 R] /Count 1 >>' % page, page_tree)
+    names = w.add('<< /JavaScript << /Names [(init) %d 0 R] >> >>' % script)
+    w.add('<< /Type /Catalog /Pages %d 0 R /OpenAction %d 0 R /Names %d 0 R >>' % (page_tree, script, names), catalog)
+    w.save(path, catalog)
+
+
+def plain(path, pages=20):
+    w = Writer()
+    catalog, page_tree = w.reserve(), w.reserve()
+    font = w.add('<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>')
+    kids = []
+    for index in range(pages):
+        text = b''.join(b'BT /F1 10 Tf 40 %d Td (Line %d of page %d) Tj ET\n' % (780 - 12 * line, line, index)
+                        for line in range(60))
+        content = w.stream(text)
+        kids.append(w.add('<< /Type /Page /Parent %d 0 R /MediaBox [0 0 612 792] /Contents %d 0 R'
+                          ' /Resources << /Font << /F1 %d 0 R >> >> >>' % (page_tree, content, font)))
+    w.add('<< /Type /Pages /Kids [%s] /Count %d >>' % (' '.join('%d 0 R' % k for k in kids), pages), page_tree)
+    w.add('<< /Type /Catalog /Pages %d 0 R >>' % page_tree, catalog)
+    info = w.add('<< /Title (Plain) /Author (syntheticForms.py) >>')
+    w.save(path, catalog, info)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit('Usage: syntheticForms.py OUTPUT_DIR')
+    directory = sys.argv[1]
+    os.makedirs(directory, exist_ok=True)
+    form(os.path.join(directory, 'forms-small.pdf'), 1, 60)
+    form(os.path.join(directory, 'forms-large.pdf'), 60, 90)
+    active(os.path.join(directory, 'active.pdf'))
+    plain(os.path.join(directory, 'plain.pdf'))
+    form(os.path.join(directory, 'broken-xref.pdf'), 1, 60, offset_error=7)
+
+
+if __name__ == '__main__':
+    main()
@@ -1,9 +1,266 @@
+import array
 import os
+import shlex
+import shutil
+import socket
+import subprocess
+import tempfile
+import threading
 import requests
-from flask import Flask, request, jsonify
+from flask import Flask, Response, request, jsonify
+from werkzeug.wsgi import wrap_file
+
+try:
+    import pdfnorm
+except ImportError:
+    pdfnorm = None
 
 app = Flask(__name__)
 
+# Per-document limits so one pathological upload can't pin the worker
+NORMALIZER_LIMITS = os.environ.get(
+    'NORMALIZER_LIMITS',
+    '--max-wall-seconds=60 --max-cpu-seconds=60 --max-decoded-bytes=1073741824 --max-heap-bytes=2147483648')
+
+NORMALIZER = os.environ.get('NORMALIZER', '/app/build/normCPP')
+# The normalizer reads its appearance templates from its working directory
+NORMALIZER_DIR = os.environ.get('NORMALIZER_DIR', '/app/build')
+# The latest result is still left here as normed.pdf for clients that fetch it from disk
+OUTPUT_DIR = os.environ.get('OUTPUT_DIR', os.path.join(NORMALIZER_DIR, 'normalized'))
+# Largest document accepted, checked as the bytes arrive rather than after they're all in
+MAX_INPUT_BYTES = int(os.environ.get('MAX_INPUT_BYTES', 256 << 20))
+CHUNK_BYTES = 64 * 1024
+
+# Exit status of the normalizer when a document runs out of budget (exitBudgetExceeded)
+EXIT_BUDGET_EXCEEDED = 3
+
+# A zygote (normCPP --zygote=SOCKET) forks every normalizer process from one warmed up parent,
+# which keeps a process per document without paying for its start up
+ZYGOTE_SOCKET = os.environ.get('ZYGOTE_SOCKET')
+
+# NORMALIZER_IN_PROCESS=1, with the pdfnorm extension built (cmake -DPYTHON_MODULE=ON), normalizes
+# documents in this process instead of a normalizer process each. Off by default: a process per
+# document keeps a crash away from the web worker and gets the process wide limits, while in
+# process the heap limit counts the growth of the whole worker, every request in it at once.
+IN_PROCESS = (pdfnorm is not None and not ZYGOTE_SOCKET
+              and os.environ.get('NORMALIZER_IN_PROCESS', '0') != '0')
+
+
+def in_process_options():
+    """NORMALIZER_LIMITS as keyword arguments for pdfnorm.normalize_file"""
+    options = {'template_directory': NORMALIZER_DIR}
+    for flag in shlex.split(NORMALIZER_LIMITS):
+        name, _, value = flag.lstrip('-').partition('=')
+        options[name.replace('-', '_')] = float(value) if name.endswith('seconds') else int(value)
+    return options
+
+
+IN_PROCESS_OPTIONS = in_process_options() if IN_PROCESS else {}
+
+
+class InputTooLarge(Exception):
+    pass
+
+
+class ZygoteProcess:
+    """A normalizer forked by the zygote, with the stdin, stdout, stderr, wait() and kill() of
+    the Popen object it stands in for"""
+
+    def __init__(self, arguments):
+        self.returncode = None
+        self.connection = socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+        try:
+            self.connection.connect(ZYGOTE_SOCKET)
+            pipes = [os.pipe() for _ in range(3)]
+            child = [pipes[0][0], pipes[1][1], pipes[2][1]]
+            try:
+                request = b'\0'.join(argument.encode() for argument in arguments)
+                self.connection.sendmsg([request], [(socket.SOL_SOCKET, socket.SCM_RIGHTS, array.array('i', child))])
+            finally:
+                for descriptor in child:
+                    os.close(descriptor)
+        except BaseException:
+            self.connection.close()
+            raise
+        self.stdin = os.fdopen(pipes[0][1], 'wb')
+        self.stdout = os.fdopen(pipes[1][0], 'rb')
+        self.stderr = os.fdopen(pipes[2][0], 'rb')
+
+    def wait(self):
+        if self.returncode is None:
+            # The zygote answers with the exit status once the child is gone
+            reply = self.connection.recv(16)
+            self.connection.close()
+            self.returncode = int(reply) if reply else -1
+        return self.returncode
+
+    def kill(self):
+        # Hanging up makes the zygote kill the child
+        if self.returncode is None:
+            self.connection.close()
+            self.returncode = -9
+
+
+def start_normalizer(arguments):
+    if ZYGOTE_SOCKET:
+        return ZygoteProcess(arguments)
+    return subprocess.Popen([NORMALIZER] + arguments, cwd=NORMALIZER_DIR, stdin=subprocess.PIPE,
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+
+
+class Normalizer:
+    """One normalizer process, the document goes in on stdin and comes back on stdout, or is
+    written to output_path when there is one, so Python never holds the whole file"""
+
+    def __init__(self, title, output_path=None):
+        output = ['-']
+        if output_path:
+            output = ['--print-etag', '--output-dir=' + os.path.dirname(os.path.abspath(output_path)),
+                      os.path.basename(output_path)]
+        self.process = start_normalizer(shlex.split(NORMALIZER_LIMITS) + [
+            '--title=' + title, '--max-input-bytes=' + str(MAX_INPUT_BYTES), '-'] + output)
+        # Read on the side, so a chatty normalizer can't stall on a full stderr pipe
+        self.errors = []
+        self.drain = threading.Thread(target=lambda: self.errors.append(self.process.stderr.read()))
+        self.drain.daemon = True
+        self.drain.start()
+
+    def feed(self, chunks):
+        """Pipe the chunks to the normalizer, raises InputTooLarge once they pass MAX_INPUT_BYTES"""
+        received = 0
+        try:
+            for chunk in chunks:
+                received += len(chunk)
+                if received > MAX_INPUT_BYTES:
+                    raise InputTooLarge()
+                self.process.stdin.write(chunk)
+            self.process.stdin.close()
+        except BrokenPipeError:
+            # The normalizer gave up before reading everything, its exit status says why
+            pass
+
+    def first_chunk(self):
+        """Wait for the output to start, returns (chunk, None) or (None, (error, status))"""
+        # Nothing is written until the document is normalized, so output means success
+        chunk = self.process.stdout.read(CHUNK_BYTES)
+        if chunk:
+            return chunk, None
+        return None, self.failure(self.close())
+
+    def finish(self):
+        """Wait for a normalizer writing to output_path, returns (ETag, None) or (None, (error, status))"""
+        messages = self.process.stdout.read().decode('utf-8', 'replace').splitlines()
+        returncode = self.close()
+        tags = [line[len('ETag: '):] for line in messages if line.startswith('ETag: ')]
+        if returncode == 0 and tags:
+            return tags[-1], None
+        return None, self.failure(returncode)
+
+    def failure(self, returncode):
+        # Progress messages share stderr with the error, which comes last
+        lines = b''.join(self.errors).decode('utf-8', 'replace').strip().splitlines()
+        error = lines[-1] if lines else 'Normalizer exited with status {}'.format(returncode)
+        # The document is at fault for errors and budget overruns, anything else is ours
+        return error, 422 if returncode in (2, EXIT_BUDGET_EXCEEDED) else 500
+
+    def output(self, first):
+        """The normalized document in chunks, starting with what first_chunk returned"""
+        try:
+            yield first
+            for chunk in iter(lambda: self.process.stdout.read(CHUNK_BYTES), b''):
+                yield chunk
+        finally:
+            self.close()
+
+    def close(self):
+        for pipe in (self.process.stdin, self.process.stdout):
+            try:
+                pipe.close()
+            except BrokenPipeError:
+                pass
+        # With stdout closed early (client gone) the normalizer dies on the broken pipe
+        returncode = self.process.wait()
+        self.drain.join()
+        return returncode
+
+    def abort(self):
+        self.process.kill()
+        self.close()
+
+
+def too_large():
+    return 'Document larger than {} bytes'.format(MAX_INPUT_BYTES), 413
+
+
+def run(normalizer, chunks):
+    """Feed chunks to normalizer, returns None or (error, status)"""
+    try:
+        normalizer.feed(chunks)
+    except InputTooLarge:
+        normalizer.abort()
+        return too_large()
+    except BaseException:
+        normalizer.abort()
+        raise
+    return None
+
+
+def normalize(title, chunks):
+    """Run chunks through a normalizer, returns (normalizer, first chunk, None) or (None, None, (error, status))"""
+    normalizer = Normalizer(title)
+    failure = run(normalizer, chunks)
+    if failure:
+        return None, None, failure
+    first, failure = normalizer.first_chunk()
+    return (normalizer, first, None) if first else (None, None, failure)
+
+
+def normalize_in_process(title, chunks, output_path):
+    """Stream chunks to a file and normalize it with pdfnorm into output_path, returns (ETag, None)
+    or (None, (error, status)). The document is never held in memory here, and the GIL is released
+    while it is processed, so other requests carry on meanwhile."""
+    # The normalizer titles the document after its input's file name
+    name = os.path.basename(title)
+    workspace = tempfile.mkdtemp(prefix='pdfnorm-')
+    try:
+        input_path = os.path.join(workspace, name if name not in ('', '.', '..') else 'upload.pdf')
+        received = 0
+        with open(input_path, 'wb') as f:
+            for chunk in chunks:
+                received += len(chunk)
+                if received > MAX_INPUT_BYTES:
+                    return None, too_large()
+                f.write(chunk)
+        return pdfnorm.normalize_file(input_path, output_path, **IN_PROCESS_OPTIONS), None
+    except pdfnorm.Error as e:
+        # The document is at fault for errors and budget overruns
+        return None, (str(e), 422)
+    finally:
+        shutil.rmtree(workspace, ignore_errors=True)
+
+
+def normalize_to_file(title, chunks, output_path):
+    """Run chunks through a normalizer writing output_path, returns (ETag, None) or (None, (error, status))"""
+    if IN_PROCESS:
+        return normalize_in_process(title, chunks, output_path)
+
+    normalizer = Normalizer(title, output_path)
+    failure = run(normalizer, chunks)
+    if failure:
+        return None, failure
+    return normalizer.finish()
+
+
+def send_output(handle, tag):
+    """Answer with an open output file. The server sends it with sendfile where it can
+    (wsgi.file_wrapper), so the bytes never pass through Python."""
+    response = Response(wrap_file(request.environ, handle, CHUNK_BYTES), mimetype='application/pdf',
+                        direct_passthrough=True)
+    response.content_length = os.fstat(handle.fileno()).st_size
+    response.headers['ETag'] = tag
+    return response
+
+
 @app.route('/')
 def index():
     return 'Hello, World!'
@@ -17,23 +274,62 @@ def download_pdf():
         return jsonify({'error': 'Missing URL'}), 400
 
     url = data['url']
-    pdf_dir = 'build/'
-    os.makedirs(pdf_dir, exist_ok=True)
-    pdf_path = os.path.join(pdf_dir, 'downloaded.pdf')
-
     try:
-        response = requests.get(url)
+        response = requests.get(url, stream=True)
         response.raise_for_status()
+    except requests.exceptions.RequestException as e:
+        return jsonify({'error': str(e)}), 500
 
-        with open(pdf_path, 'wb') as f:
-            f.write(response.content)
+    # Written next to OUTPUT_DIR/normed.pdf, then renamed over it so readers never see half a file
+    os.makedirs(OUTPUT_DIR, exist_ok=True)
+    descriptor, staging = tempfile.mkstemp(dir=OUTPUT_DIR, prefix='.', suffix='.pdf')
+    os.close(descriptor)
+    try:
+        with response:
+            length = response.headers.get('Content-Length')
+            if length and length.isdigit() and int(length) > MAX_INPUT_BYTES:
+                return jsonify({'error': 'Document larger than {} bytes'.format(MAX_INPUT_BYTES)}), 413
+            # Same title as when the download was saved as downloaded.pdf
+            tag, failure = normalize_to_file('downloaded.pdf', response.iter_content(CHUNK_BYTES), staging)
+        if failure:
+            error, status = failure
+            return jsonify({'error': error}), status
 
+        # Opened before the rename, so a newer normed.pdf can't replace this answer
+        handle = open(staging, 'rb')
+        os.replace(staging, os.path.join(OUTPUT_DIR, 'normed.pdf'))
+        return send_output(handle, tag)
     except requests.exceptions.RequestException as e:
         return jsonify({'error': str(e)}), 500
+    finally:
+        if os.path.exists(staging):
+            os.unlink(staging)
+
+@app.route('/normalize', methods=['POST'])
+def normalize_upload():
+    """The PDF as the request body (?name= sets the title), answered with the normalized PDF"""
+    if request.content_length is not None and request.content_length > MAX_INPUT_BYTES:
+        return jsonify({'error': 'Document larger than {} bytes'.format(MAX_INPUT_BYTES)}), 413
+
+    body = iter(lambda: request.stream.read(CHUNK_BYTES), b'')
+    if IN_PROCESS:
+        descriptor, output_path = tempfile.mkstemp(prefix='pdfnorm-', suffix='.pdf')
+        os.close(descriptor)
+        try:
+            tag, failure = normalize_in_process(request.args.get('name', 'upload.pdf'), body, output_path)
+            if failure:
+                error, status = failure
+                return jsonify({'error': error}), status
+            # Still readable once unlinked, for as long as the response takes to send it
+            return send_output(open(output_path, 'rb'), tag)
+        finally:
+            os.unlink(output_path)
 
-    # run the normCPP script
-    os.system('/app/build/normCPP downloaded.pdf normed.pdf')
-    return jsonify({'message': 'PDF downloaded and processed successfully'}), 200
+    normalizer, first, failure = normalize(request.args.get('name', 'upload.pdf'), body)
+    if failure:
+        error, status = failure
+        return jsonify({'error': error}), status
+    return Response(normalizer.output(first), mimetype='application/pdf')
 
 if __name__ == '__main__':
-    app.run(host='0.0.0.0', port=5000)
\ No newline at end of file
+    app.run(host='0.0.0.0', port=5000, threaded=True)
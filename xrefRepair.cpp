@@ -0,0 +1,512 @@
+#include "xrefRepair.h"
+#include "budget.h"
+#include "parallel.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// Longest object stream header (the object number and offset pairs) that gets inflated
+const uint64_t maxObjectStreamHeader = 1 << 20;
+
+// Smallest byte range given to a scanning thread, below this threads cost more than they save
+const size_t minRangeBytes = 4 << 20;
+
+// Start of the next occurrence of token (two bytes or longer) at or after p, or end
+const char* findToken(const char* p, const char* end, string_view token) {
+#if defined(__SSE2__)
+    // Match the first two bytes sixteen positions at a time, then compare the rest
+    const __m128i first = _mm_set1_epi8(token[0]);
+    const __m128i second = _mm_set1_epi8(token[1]);
+    while (end - p >= 17) {
+        __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(current, first), _mm_cmpeq_epi8(next, second)));
+        while (mask) {
+            const char* candidate = p + __builtin_ctz(mask);
+            if (static_cast<size_t>(end - candidate) >= token.size()
+                && memcmp(candidate, token.data(), token.size()) == 0) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+        p += 16;
+    }
+#endif
+    string_view rest(p, end - p);
+    size_t found = rest.find(token);
+    return found == string_view::npos ? end : p + found;
+}
+
+bool isWhite(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\0';
+}
+
+bool isDelimiter(char c) {
+    return isWhite(c) || strchr("()<>[]{}/%", c) != nullptr;
+}
+
+// Object number and generation of the "N G obj" header whose "obj" keyword is at obj
+bool parseHeader(const char* data, const char* end, const char* obj,
+                 const char*& header, uint64_t& number, uint64_t& generation) {
+    if (obj + 3 < end && !isDelimiter(obj[3])) {
+        return false;
+    }
+
+    const char* p = obj;
+    auto skipWhite = [&p, data]() {
+        const char* start = p;
+        while (p > data && isWhite(p[-1])) {
+            p--;
+        }
+        return p != start;
+    };
+    auto digits = [&p, data](uint64_t& value) {
+        const char* digitsEnd = p;
+        while (p > data && isdigit(static_cast<unsigned char>(p[-1])) && digitsEnd - p < 10) {
+            p--;
+        }
+        value = 0;
+        for (const char* digit = p; digit < digitsEnd; digit++) {
+            value = value * 10 + (*digit - '0');
+        }
+        return p != digitsEnd && (p == data || !isdigit(static_cast<unsigned char>(p[-1])));
+    };
+
+    if (!skipWhite() || !digits(generation) || !skipWhite() || !digits(number)) {
+        return false;
+    }
+    if (p > data && !isDelimiter(p[-1])) {
+        return false;
+    }
+    header = p;
+    return true;
+}
+
+// Unsigned number at pos (after any white space), pos is left after it
+bool nextNumber(string_view text, size_t& pos, uint64_t& value) {
+    while (pos < text.size() && isWhite(text[pos])) {
+        pos++;
+    }
+    size_t start = pos;
+    value = 0;
+    while (pos < text.size() && isdigit(static_cast<unsigned char>(text[pos])) && pos - start < 19) {
+        value = value * 10 + (text[pos++] - '0');
+    }
+    return pos > start;
+}
+
+bool numberAfterKey(string_view text, string_view key, uint64_t& value) {
+    size_t pos = text.find(key);
+    return pos != string_view::npos && nextNumber(text, pos += key.size(), value);
+}
+
+// Last "key N G R" in the file. Searched forwards with findToken, which beats a byte at a time
+// rfind over the whole file when the key (say /Encrypt) isn't there at all
+bool findLastReference(const char* data, const char* end, string_view key, uint64_t& number, uint64_t& generation) {
+    string_view file(data, end - data);
+    bool found = false;
+    for (const char* p = findToken(data, end, key); p != end; p = findToken(p + key.size(), end, key)) {
+        size_t pos = p - data + key.size();
+        uint64_t candidateNumber = 0;
+        uint64_t candidateGeneration = 0;
+        if (!nextNumber(file, pos, candidateNumber) || !nextNumber(file, pos, candidateGeneration)) {
+            continue;
+        }
+        while (pos < file.size() && isWhite(file[pos])) {
+            pos++;
+        }
+        if (pos < file.size() && file[pos] == 'R') {
+            number = candidateNumber;
+            generation = candidateGeneration;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// End of the string (hex or literal) at pos, npos when there isn't a whole one
+size_t stringEnd(string_view file, size_t pos) {
+    if (pos >= file.size()) {
+        return string_view::npos;
+    }
+    if (file[pos] == '<') {
+        size_t close = file.find('>', pos);
+        return close == string_view::npos ? close : close + 1;
+    }
+    if (file[pos] != '(') {
+        return string_view::npos;
+    }
+    // Literal strings nest balanced parentheses, and a backslash escapes the next byte
+    int depth = 0;
+    for (; pos < file.size(); pos++) {
+        if (file[pos] == '\\') {
+            pos++;
+        } else if (file[pos] == '(') {
+            depth++;
+        } else if (file[pos] == ')' && --depth == 0) {
+            return pos + 1;
+        }
+    }
+    return string_view::npos;
+}
+
+// The last "/ID [<...> <...>]" in the file, copied as written. Encrypted files derive their key
+// from the first string, so the rebuilt trailer can't do without it.
+bool findLastId(const char* data, const char* end, string& id) {
+    string_view file(data, end - data);
+    bool found = false;
+    for (const char* p = findToken(data, end, "/ID"); p != end; p = findToken(p + 3, end, "/ID")) {
+        size_t pos = p - data + 3;
+        while (pos < file.size() && isWhite(file[pos])) {
+            pos++;
+        }
+        if (pos >= file.size() || file[pos] != '[') {
+            continue;
+        }
+        size_t start = pos++;
+        bool parsed = true;
+        for (int i = 0; i < 2 && parsed; i++) {
+            while (pos < file.size() && isWhite(file[pos])) {
+                pos++;
+            }
+            pos = stringEnd(file, pos);
+            parsed = pos != string_view::npos;
+        }
+        while (parsed && pos < file.size() && isWhite(file[pos])) {
+            pos++;
+        }
+        if (parsed && pos < file.size() && file[pos] == ']') {
+            id = string(file.substr(start, pos + 1 - start));
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Entry of the rebuilt table, in the shape of an xref stream row: type 1 is a direct object
+// (offset, generation), type 2 one stored in an object stream (stream number, index)
+struct Entry {
+    uint64_t field2 = 0;
+    uint16_t field3 = 0;
+    uint8_t type = 0;
+};
+
+// An object found by its "N G obj" header. Offsets are from the start of the file, streamEnd
+// is the offset of the endstream when the object has stream data (0 otherwise).
+struct Candidate {
+    uint64_t keyword;
+    uint64_t header;
+    uint64_t number;
+    uint16_t generation;
+    bool objectStream;
+    bool catalog;
+    uint64_t streamEnd;
+};
+
+// Every object header whose "obj" keyword starts in [from, to). Reads past to (to find where
+// an object's stream data ends) but never decides anything about headers outside the range,
+// so ranges can be scanned independently and their results concatenated.
+vector<Candidate> scanRange(const char* data, const char* end, const char* from, const char* to, uint64_t maxNumber) {
+    vector<Candidate> found;
+    const char* p = findToken(from, min(to + 2, end), "obj");
+    while (p < to) {
+        const char* body = p + 3;
+        const char* nextObj = findToken(body, end, "obj");
+        const char* header = nullptr;
+        uint64_t number = 0;
+        uint64_t generation = 0;
+        if (parseHeader(data, end, p, header, number, generation)
+            && number > 0 && number <= maxNumber && generation <= UINT16_MAX) {
+            // The "stream" keyword (not the tail of an "endstream") before the next object keyword
+            const char* streamKeyword = findToken(body, nextObj, "stream");
+            while (streamKeyword != nextObj && streamKeyword - data >= 3 && memcmp(streamKeyword - 3, "end", 3) == 0) {
+                streamKeyword = findToken(streamKeyword + 6, nextObj, "stream");
+            }
+            uint64_t streamEnd = 0;
+            if (streamKeyword != nextObj) {
+                const char* endstream = findToken(streamKeyword, end, "endstream");
+                streamEnd = endstream == end ? 0 : endstream - data;
+            }
+            string_view dict(body, min<size_t>(streamKeyword - body, 4096));
+            found.push_back({ static_cast<uint64_t>(p - data), static_cast<uint64_t>(header - data), number,
+                              static_cast<uint16_t>(generation), dict.find("/ObjStm") != string_view::npos,
+                              dict.find("/Catalog") != string_view::npos, streamEnd });
+
+            // Step over the stream data. Should this header itself sit in the data of a stream
+            // that started in an earlier range, its endstream is at or before that stream's,
+            // so the merge would have dropped everything skipped here anyway
+            if (streamEnd != 0) {
+                p = data + streamEnd < to ? findToken(data + streamEnd, min(to + 2, end), "obj") : to;
+                continue;
+            }
+        }
+        p = nextObj;
+    }
+    return found;
+}
+
+// Candidates found by scanning the file as byte ranges on up to threads threads, in file order
+vector<vector<Candidate>> scanFile(const char* data, size_t size, unsigned threads, uint64_t maxNumber) {
+    const char* end = data + size;
+    size_t ranges = max<size_t>(1, min<size_t>(threads, size / minRangeBytes));
+    vector<vector<Candidate>> scanned(ranges);
+    parallelFor(ranges, threads, [&](size_t range) {
+        const char* from = data + size / ranges * range;
+        const char* to = range + 1 == ranges ? end : data + size / ranges * (range + 1);
+        scanned[range] = scanRange(data, end, from, to, maxNumber);
+    });
+    return scanned;
+}
+
+// Dictionary and data of the stream object whose header starts at header, false without one
+bool streamData(const char* end, const char* header, string_view& dict, const char*& body, const char*& bodyEnd) {
+    const char* keyword = findToken(header, end, "stream");
+    if (keyword == end) {
+        return false;
+    }
+    dict = string_view(header, keyword - header);
+    body = keyword + 6;
+    if (body < end && *body == '\r') {
+        body++;
+    }
+    if (body < end && *body == '\n') {
+        body++;
+    }
+    bodyEnd = findToken(body, end, "endstream");
+    return true;
+}
+
+// Object numbers stored in an object stream, in index order (0 for entries that are unusable).
+// Only the header with the numbers is inflated.
+vector<uint64_t> readObjectStream(const char* end, const char* header, uint64_t maxNumber) {
+    vector<uint64_t> numbers;
+    string_view dict;
+    const char* body = nullptr;
+    const char* bodyEnd = nullptr;
+    if (!streamData(end, header, dict, body, bodyEnd)) {
+        return numbers;
+    }
+    uint64_t count = 0;
+    uint64_t first = 0;
+    if (!numberAfterKey(dict, "/N", count) || !numberAfterKey(dict, "/First", first)
+        || first > maxObjectStreamHeader || dict.find("/DecodeParms") != string_view::npos) {
+        return numbers;
+    }
+    bool flate = dict.find("/FlateDecode") != string_view::npos;
+    if (!flate && dict.find("/Filter") != string_view::npos) {
+        return numbers;
+    }
+
+    string objectHeader(first, '\0');
+    size_t produced = 0;
+    if (flate) {
+        z_stream inflater {};
+        if (inflateInit(&inflater) != Z_OK) {
+            return numbers;
+        }
+        inflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(body));
+        inflater.avail_in = static_cast<uInt>(min<size_t>(bodyEnd - body, UINT32_MAX));
+        inflater.next_out = reinterpret_cast<Bytef*>(&objectHeader[0]);
+        inflater.avail_out = static_cast<uInt>(first);
+        inflate(&inflater, Z_SYNC_FLUSH);
+        produced = first - inflater.avail_out;
+        inflateEnd(&inflater);
+    } else {
+        produced = min<size_t>(first, bodyEnd - body);
+        memcpy(&objectHeader[0], body, produced);
+    }
+    objectHeader.resize(produced);
+
+    size_t pos = 0;
+    for (uint64_t index = 0; index < count && index <= UINT16_MAX; index++) {
+        uint64_t number = 0;
+        uint64_t offset = 0;
+        if (!nextNumber(objectHeader, pos, number) || !nextNumber(objectHeader, pos, offset)) {
+            break;
+        }
+        numbers.push_back(number <= maxNumber ? number : 0);
+    }
+    return numbers;
+}
+
+void putBigEndian(string& out, uint64_t value, int bytes) {
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>((value >> shift) & 0xFF));
+    }
+}
+
+} // namespace
+
+string repairXref(const char* data, size_t size, unsigned threads, XrefRepairStats& stats) {
+    auto started = chrono::steady_clock::now();
+    const char* end = data + size;
+    // An object takes at least eight bytes ("1 0 obj\n"), larger numbers are garbage
+    const uint64_t maxNumber = size / 8 + 1;
+
+    // Header candidates from independent byte ranges, scanned in parallel on large files
+    vector<vector<Candidate>> scanned = scanFile(data, size, threads, maxNumber);
+
+    // Merged in file order, which gives the serial semantics: headers inside the stream data of an
+    // accepted object (an embedded PDF say) aren't objects, and later definitions win, as they
+    // would with incremental updates
+    vector<Entry> entries;
+    vector<Candidate> objectStreams;
+    uint64_t catalog = 0;
+    uint64_t skipUntil = 0;
+    for (const auto& candidates : scanned) {
+        for (const Candidate& candidate : candidates) {
+            if (candidate.keyword < skipUntil) {
+                continue;
+            }
+            if (++stats.objects % 4096 == 0) {
+                checkBudget("xref repair");
+            }
+            if (candidate.number >= entries.size()) {
+                entries.resize(candidate.number + 1);
+            }
+            entries[candidate.number] = { candidate.header, candidate.generation, 1 };
+            if (candidate.objectStream) {
+                objectStreams.push_back(candidate);
+            }
+            if (candidate.catalog) {
+                catalog = candidate.number;
+            }
+            skipUntil = max(skipUntil, candidate.streamEnd);
+        }
+    }
+
+    // Object stream headers are inflated in parallel, then applied in file order. The decoded
+    // bytes were charged as a whole before the load (chargeObjectStreams())
+    vector<vector<uint64_t>> compressed(objectStreams.size());
+    parallelFor(objectStreams.size(), threads, [&](size_t i) {
+        compressed[i] = readObjectStream(end, data + objectStreams[i].header, maxNumber);
+    });
+    for (size_t i = 0; i < objectStreams.size(); i++) {
+        for (size_t index = 0; index < compressed[i].size(); index++) {
+            uint64_t number = compressed[i][index];
+            if (number == 0) {
+                continue;
+            }
+            if (number >= entries.size()) {
+                entries.resize(number + 1);
+            }
+            // A direct definition after this object stream (an incremental update) takes precedence
+            Entry& entry = entries[number];
+            if (entry.type == 1 && entry.field2 > objectStreams[i].header) {
+                continue;
+            }
+            entry = { objectStreams[i].number, static_cast<uint16_t>(index), 2 };
+            stats.compressedObjects++;
+        }
+    }
+
+    uint64_t rootNumber = 0;
+    uint64_t rootGeneration = 0;
+    auto known = [&entries](uint64_t number) { return number > 0 && number < entries.size() && entries[number].type != 0; };
+    if (!findLastReference(data, end, "/Root", rootNumber, rootGeneration) || !known(rootNumber)) {
+        rootNumber = catalog;
+        rootGeneration = 0;
+    }
+    if (!known(rootNumber)) {
+        return string();
+    }
+
+    string trailer = " /Root " + to_string(rootNumber) + " " + to_string(rootGeneration) + " R";
+    bool encrypted = false;
+    for (const char* key : { "/Info", "/Encrypt" }) {
+        uint64_t number = 0;
+        uint64_t generation = 0;
+        if (findLastReference(data, end, key, number, generation) && known(number)) {
+            trailer += string(" ") + key + " " + to_string(number) + " " + to_string(generation) + " R";
+            encrypted = key[1] == 'E';
+        }
+    }
+    string id;
+    if (findLastId(data, end, id)) {
+        trailer += " /ID " + id;
+    } else if (encrypted) {
+        throw runtime_error("xref repair found no /ID to decrypt the file with");
+    }
+
+    string repaired(data, size);
+    if (repaired.empty() || (repaired.back() != '\n' && repaired.back() != '\r')) {
+        repaired.push_back('\n');
+    }
+
+    // The new table is an uncompressed xref stream, so objects inside object streams keep
+    // working; it is written as object number "size" and lists itself
+    uint64_t xrefNumber = max<uint64_t>(entries.size(), 1);
+    entries.resize(xrefNumber + 1);
+    entries[0] = { 0, UINT16_MAX, 0 };
+    entries[xrefNumber] = { repaired.size(), 0, 1 };
+    string table;
+    table.reserve(entries.size() * 11);
+    for (const Entry& entry : entries) {
+        putBigEndian(table, entry.type, 1);
+        putBigEndian(table, entry.field2, 8);
+        putBigEndian(table, entry.field3, 2);
+    }
+
+    uint64_t xrefOffset = repaired.size();
+    repaired += to_string(xrefNumber) + " 0 obj\n<< /Type /XRef /Size " + to_string(entries.size())
+        + " /W [1 8 2]" + trailer + " /Length " + to_string(table.size()) + " >>\nstream\n";
+    repaired += table;
+    repaired += "\nendstream\nendobj\nstartxref\n" + to_string(xrefOffset) + "\n%%EOF\n";
+
+    stats.milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+    return repaired;
+}
+
+void chargeObjectStreams(const char* data, size_t size, unsigned threads) {
+    if (!decodedBytesLimited()) {
+        return;
+    }
+    const char* end = data + size;
+    const uint64_t maxNumber = size / 8 + 1;
+
+    // The object streams as the repair would take them, skipping headers inside stream data
+    vector<const char*> headers;
+    uint64_t skipUntil = 0;
+    for (const auto& candidates : scanFile(data, size, threads, maxNumber)) {
+        for (const Candidate& candidate : candidates) {
+            if (candidate.keyword < skipUntil) {
+                continue;
+            }
+            if (candidate.objectStream) {
+                headers.push_back(data + candidate.header);
+            }
+            skipUntil = max(skipUntil, candidate.streamEnd);
+        }
+    }
+
+    // Inflated on the workers, which charge this thread's budget and stop at its limit
+    parallelFor(headers.size(), threads, [&](size_t i) {
+        string_view dict;
+        const char* body = nullptr;
+        const char* bodyEnd = nullptr;
+        if (!streamData(end, headers[i], dict, body, bodyEnd)) {
+            return;
+        }
+        if (dict.find("/FlateDecode") != string_view::npos) {
+            chargeInflatedBytes(body, bodyEnd - body, "load");
+        } else {
+            chargeDecodedBytes(bodyEnd - body, "load");
+        }
+    });
+}
@@ -0,0 +1,29 @@
+#ifndef XREF_REPAIR_H
+#define XREF_REPAIR_H
+
+#include <cstddef>
+#include <string>
+
+struct XrefRepairStats {
+    size_t objects = 0;             // Objects found as "N G obj" in the file
+    size_t compressedObjects = 0;   // Objects found in the headers of object streams
+    double milliseconds = 0;
+};
+
+// Rebuild the cross reference table of a damaged file from one pass over its bytes. Returns
+// the file with a new xref stream (covering direct and object stream objects) and trailer
+// appended, or an empty string when no catalog could be found. The trailer keeps the last /ID
+// in the file, which an encrypted file needs to be decrypted, so an encrypted file without one
+// throws std::runtime_error. Time is linear in the file size and memory is bounded by it:
+// object numbers past one per eight bytes are ignored. Large files are scanned as byte ranges on
+// up to threads threads (object stream headers are inflated the same way); the result doesn't
+// depend on the thread count.
+std::string repairXref(const char* data, size_t size, unsigned threads, XrefRepairStats& stats);
+
+// Charge the budget on this thread for what PoDoFo will decode when it loads the file: every
+// object stream, inflated (FlateDecode) a piece at a time so a decompression bomb stops at the
+// limit before PoDoFo gets to it, or at its raw size with other filters. Nothing happens
+// unless the budget limits decoded bytes.
+void chargeObjectStreams(const char* data, size_t size, unsigned threads);
+
+#endif // XREF_REPAIR_H
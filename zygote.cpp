@@ -0,0 +1,212 @@
+#include "zygote.h"
+#include "parallel.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const size_t maxRequestBytes = 64 << 10;
+const unsigned jobDescriptors = 3;
+
+// A child that hasn't received its request by then gives up
+const time_t requestTimeoutSeconds = 10;
+
+struct Job {
+    int connection;
+    bool killed = false;
+};
+
+// The request of a job, read in the child: its arguments and the descriptors for its stdin, stdout and stderr
+bool receiveJob(int connection, vector<string>& arguments, int descriptors[jobDescriptors]) {
+    timeval timeout { requestTimeoutSeconds, 0 };
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    vector<char> buffer(maxRequestBytes);
+    alignas(cmsghdr) char control[CMSG_SPACE(jobDescriptors * sizeof(int))];
+    iovec part { buffer.data(), buffer.size() };
+    msghdr message {};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t size = recvmsg(connection, &message, 0);
+    if (size < 0 || (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0) {
+        return false;
+    }
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS
+        || header->cmsg_len != CMSG_LEN(jobDescriptors * sizeof(int))) {
+        return false;
+    }
+    memcpy(descriptors, CMSG_DATA(header), jobDescriptors * sizeof(int));
+
+    for (const char* p = buffer.data(), *end = p + size; p < end;) {
+        const char* stop = static_cast<const char*>(memchr(p, '\0', end - p));
+        stop = stop ? stop : end;
+        arguments.emplace_back(p, stop);
+        p = stop + 1;
+    }
+    return true;
+}
+
+[[noreturn]] void runChild(int connection, int listener, int signals, const unordered_map<pid_t, Job>& jobs,
+                           const function<int(const vector<string>&)>& job) {
+    // Nothing of the zygote's but the warm state
+    close(listener);
+    close(signals);
+    for (const auto& entry : jobs) {
+        close(entry.second.connection);
+    }
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, nullptr);
+
+    vector<string> arguments;
+    int descriptors[jobDescriptors];
+    if (!receiveJob(connection, arguments, descriptors)) {
+        _exit(1);
+    }
+    close(connection);
+    for (unsigned i = 0; i < jobDescriptors; i++) {
+        dup2(descriptors[i], static_cast<int>(i));
+    }
+    for (int descriptor : descriptors) {
+        if (descriptor >= static_cast<int>(jobDescriptors)) {
+            close(descriptor);
+        }
+    }
+
+    int status = 2;
+    try {
+        status = job(arguments);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+    }
+    cout.flush();
+    std::cerr.flush();
+    fflush(nullptr);
+    // Skip the zygote's exit handlers, they belong to the parent
+    _exit(status);
+}
+
+// Answer the jobs whose children have exited
+void reapChildren(unordered_map<pid_t, Job>& jobs) {
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        auto found = jobs.find(pid);
+        if (found == jobs.end()) {
+            continue;
+        }
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        string reply = to_string(code);
+        ssize_t ignored = send(found->second.connection, reply.data(), reply.size(), MSG_NOSIGNAL);
+        (void)ignored;
+        close(found->second.connection);
+        jobs.erase(found);
+    }
+}
+
+} // namespace
+
+int runZygote(const ZygoteOptions& options, const function<int(const vector<string>&)>& job) {
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (options.socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << options.socketPath << std::endl;
+        return 2;
+    }
+    strcpy(address.sun_path, options.socketPath.c_str());
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    unlink(options.socketPath.c_str());
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "Cannot listen on " << options.socketPath << ": " << strerror(errno) << std::endl;
+        return 2;
+    }
+
+    // Exited children are picked up through a signalfd, so the loop below is the only thing running
+    sigset_t childSignals;
+    sigemptyset(&childSignals);
+    sigaddset(&childSignals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childSignals, nullptr);
+    int signals = signalfd(-1, &childSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signals < 0) {
+        std::cerr << "Cannot watch for exiting jobs: " << strerror(errno) << std::endl;
+        return 2;
+    }
+
+    unsigned maxJobs = workerCount(options.maxJobs);
+    unordered_map<pid_t, Job> jobs;
+    cout << "Zygote listening on " << options.socketPath << ", up to " << maxJobs << " jobs at once" << endl;
+
+    vector<pollfd> watched;
+    vector<pid_t> watchedJobs;
+    for (;;) {
+        // The children's connections are only watched for the client hanging up
+        watched.assign({ { signals, POLLIN, 0 }, { listener, static_cast<short>(jobs.size() < maxJobs ? POLLIN : 0), 0 } });
+        watchedJobs.clear();
+        for (const auto& entry : jobs) {
+            if (!entry.second.killed) {
+                watched.push_back({ entry.second.connection, POLLRDHUP, 0 });
+                watchedJobs.push_back(entry.first);
+            }
+        }
+        if (poll(watched.data(), watched.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "poll: " << strerror(errno) << std::endl;
+            return 2;
+        }
+
+        for (size_t i = 0; i < watchedJobs.size(); i++) {
+            if (watched[i + 2].revents != 0) {
+                kill(watchedJobs[i], SIGKILL);
+                jobs[watchedJobs[i]].killed = true;
+            }
+        }
+
+        if (watched[0].revents & POLLIN) {
+            signalfd_siginfo info;
+            while (read(signals, &info, sizeof(info)) == sizeof(info)) {
+            }
+            reapChildren(jobs);
+        }
+
+        if (watched[1].revents & POLLIN) {
+            int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (connection < 0) {
+                continue;
+            }
+            // Anything buffered would otherwise be written again by the child
+            cout.flush();
+            std::cerr.flush();
+            fflush(nullptr);
+            pid_t pid = fork();
+            if (pid == 0) {
+                runChild(connection, listener, signals, jobs, job);
+            }
+            if (pid < 0) {
+                std::cerr << "fork: " << strerror(errno) << std::endl;
+                close(connection);
+                continue;
+            }
+            jobs[pid] = Job { connection };
+        }
+    }
+}
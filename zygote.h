@@ -0,0 +1,24 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+struct ZygoteOptions {
+    std::string socketPath;     // Unix socket the jobs come in on, empty when not running as a zygote
+    unsigned maxJobs = 0;       // Children at once, 0 for one per hardware thread; more jobs wait to be accepted
+    std::string warmupFile;     // Normalized once before serving, to warm up everything a document touches
+};
+
+// Fork server for jobs that each need their own process. The caller warms this process up
+// first; every job then runs in a child forked from it, which inherits the warm state copy on
+// write. A job is one message on the SOCK_SEQPACKET socket: command line arguments separated
+// by NUL bytes, with the descriptors for the job's stdin, stdout and stderr attached
+// (SCM_RIGHTS). The child makes those its standard streams, runs job(arguments) and exits with
+// what it returns. The zygote then answers with the exit status as text, 128 + the signal number
+// when the child was killed, and closes the connection. Hanging up before that kills the child.
+// Only returns when the zygote can't start.
+int runZygote(const ZygoteOptions& options, const std::function<int(const std::vector<std::string>&)>& job);
+
+#endif // ZYGOTE_H